@@ -19,6 +19,14 @@ lblock(lua_State *L) {
 	return 1;
 }
 
+static int
+lcurrent(lua_State *L) {
+	size_t t = malloc_current_memory();
+	lua_pushinteger(L, (lua_Integer)t);
+
+	return 1;
+}
+
 static int
 ldumpinfo(lua_State *L) {
 	memory_info_dump();
@@ -40,6 +48,7 @@ luaopen_memory(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "total", ltotal },
 		{ "block", lblock },
+		{ "current", lcurrent },
 		{ "dumpinfo", ldumpinfo },
 		{ "dump", ldump },
 		{ NULL, NULL },
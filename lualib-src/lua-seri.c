@@ -32,77 +32,61 @@
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define STACK_SIZE 1024
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
-};
-
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;	/* the stack buffer at first, then the heap */
+	char * stack;
+	int cap;
 	int len;
-	int ptr;
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int lazy;	/* push the tables as lazy tables */
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	if (b->buffer == b->stack) {
+		b->buffer = skynet_malloc(cap);
+		memcpy(b->buffer, b->stack, b->len);
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb , char *stack, int sz) {
+	wb->buffer = stack;
+	wb->stack = stack;
+	wb->cap = sz;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->stack) {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = wb->stack;
 	wb->len = 0;
 }
 
@@ -111,6 +95,7 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->lazy = 0;
 }
 
 static void *
@@ -211,6 +196,8 @@ wb_string(struct write_block *wb, const char *str, int len) {
 }
 
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
+static int lazy_data(lua_State *L);
+static int lazy_meta(lua_State *L);
 
 static int
 wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
@@ -254,12 +241,40 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 	wb_nil(wb);
 }
 
+// a lazy table not decoded yet is packed as the encoded bytes it keeps, see lazy_table
+static int
+wb_lazy(lua_State *L, struct write_block *wb, int index) {
+	if (!lua_getmetatable(L, index)) {
+		return 0;
+	}
+	lua_rawgetp(L, LUA_REGISTRYINDEX, lazy_meta);
+	int lazy = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+	if (!lazy) {
+		return 0;
+	}
+	lua_rawgetp(L, LUA_REGISTRYINDEX, lazy_data);
+	lua_pushvalue(L, index);
+	if (lua_rawget(L, -2) != LUA_TSTRING) {
+		lua_pop(L, 2);
+		return 0;
+	}
+	size_t sz = 0;
+	const char * data = lua_tolstring(L, -1, &sz);
+	wb_push(wb, data, (int)sz);
+	lua_pop(L, 2);
+	return 1;
+}
+
 static void
 wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	luaL_checkstack(L, LUA_MINSTACK, NULL);
 	if (index < 0) {
 		index = lua_gettop(L) + index + 1;
 	}
+	if (wb_lazy(L, wb, index)) {
+		return;
+	}
 	int array_size = wb_table_array(L, wb, index, depth);
 	wb_table_hash(L, wb, index, depth, array_size);
 }
@@ -402,8 +417,8 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 
 static void unpack_one(lua_State *L, struct read_block *rb);
 
-static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+static int
+get_array_size(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		uint8_t *t = rb_read(rb, sizeof(type));
@@ -417,8 +432,12 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		}
 		array_size = get_integer(L,rb,cookie);
 	}
-	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	return array_size;
+}
+
+// fill the table on the top of stack
+static void
+fill_table(lua_State *L, struct read_block *rb, int array_size) {
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
@@ -435,6 +454,214 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+static void
+unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+	array_size = get_array_size(L, rb, array_size);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	lua_createtable(L,array_size,0);
+	fill_table(L, rb, array_size);
+}
+
+static void skip_one(lua_State *L, struct read_block *rb);
+
+static void
+skip_buffer(lua_State *L, struct read_block *rb, int len) {
+	if (rb_read(rb, len) == NULL) {
+		invalid_stream(L,rb);
+	}
+}
+
+// walk a value without pushing it
+static void
+skip_value(lua_State *L, struct read_block *rb, int type, int cookie) {
+	switch(type) {
+	case TYPE_NIL:
+	case TYPE_BOOLEAN:
+		break;
+	case TYPE_NUMBER:
+		if (cookie == TYPE_NUMBER_REAL) {
+			get_real(L,rb);
+		} else {
+			get_integer(L,rb,cookie);
+		}
+		break;
+	case TYPE_USERDATA:
+		get_pointer(L,rb);
+		break;
+	case TYPE_SHORT_STRING:
+		skip_buffer(L,rb,cookie);
+		break;
+	case TYPE_LONG_STRING: {
+		if (cookie == 2) {
+			uint16_t n;
+			uint16_t *plen = rb_read(rb, 2);
+			if (plen == NULL) {
+				invalid_stream(L,rb);
+			}
+			memcpy(&n, plen, sizeof(n));
+			skip_buffer(L,rb,n);
+		} else {
+			uint32_t n;
+			uint32_t *plen = rb_read(rb, 4);
+			if (cookie != 4 || plen == NULL) {
+				invalid_stream(L,rb);
+			}
+			memcpy(&n, plen, sizeof(n));
+			skip_buffer(L,rb,n);
+		}
+		break;
+	}
+	case TYPE_TABLE: {
+		int array_size = get_array_size(L, rb, cookie);
+		int i;
+		for (i=0;i<array_size;i++) {
+			skip_one(L,rb);
+		}
+		for (;;) {
+			uint8_t *t = rb_read(rb, 1);
+			if (t == NULL) {
+				invalid_stream(L,rb);
+			}
+			if (*t == TYPE_NIL) {
+				break;
+			}
+			skip_value(L, rb, *t & 0x7, *t >> 3);
+			skip_one(L,rb);
+		}
+		break;
+	}
+	default:
+		invalid_stream(L,rb);
+		break;
+	}
+}
+
+static void
+skip_one(lua_State *L, struct read_block *rb) {
+	uint8_t *t = rb_read(rb, 1);
+	if (t==NULL) {
+		invalid_stream(L, rb);
+	}
+	skip_value(L, rb, *t & 0x7, *t >> 3);
+}
+
+/*
+	A lazy table is an empty table with the metatable lazy_meta, the encoded bytes of
+	the table are kept in a weak table (registry[lazy_data]). The first access decodes
+	one level into the table itself and removes the metatable, the sub tables are lazy too.
+	A lazy table not decoded yet is packed again as its encoded bytes, see wb_lazy.
+ */
+
+// decode the lazy table at index
+static void
+lazy_fill(lua_State *L, int index) {
+	index = lua_absindex(L, index);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, lazy_data);
+	lua_pushvalue(L, index);
+	if (lua_rawget(L, -2) != LUA_TSTRING) {
+		lua_pop(L, 2);
+		return;
+	}
+	lua_pushvalue(L, index);
+	lua_pushnil(L);
+	lua_rawset(L, -4);
+	lua_pushnil(L);
+	lua_setmetatable(L, index);
+
+	size_t sz = 0;
+	const char * data = lua_tolstring(L, -1, &sz);
+	struct read_block rb;
+	rball_init(&rb, (char *)data, (int)sz);
+	rb.lazy = 1;
+	uint8_t *t = rb_read(&rb, 1);
+	int array_size = get_array_size(L, &rb, *t >> 3);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	lua_pushvalue(L, index);
+	fill_table(L, &rb, array_size);
+	lua_pop(L, 3);
+}
+
+static int
+lazy_index(lua_State *L) {
+	lazy_fill(L, 1);
+	lua_settop(L, 2);
+	lua_rawget(L, 1);
+	return 1;
+}
+
+static int
+lazy_newindex(lua_State *L) {
+	lazy_fill(L, 1);
+	lua_settop(L, 3);
+	lua_rawset(L, 1);
+	return 0;
+}
+
+static int
+lazy_len(lua_State *L) {
+	lazy_fill(L, 1);
+	lua_pushinteger(L, lua_rawlen(L, 1));
+	return 1;
+}
+
+static int
+lazy_pairs(lua_State *L) {
+	lazy_fill(L, 1);
+	lua_getglobal(L, "next");
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int
+lazy_data(lua_State *L) {
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, lazy_data) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, lazy_data);
+	}
+	return 1;
+}
+
+static int
+lazy_meta(lua_State *L) {
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, lazy_meta) == LUA_TNIL) {
+		lua_pop(L, 1);
+		luaL_Reg l[] = {
+			{ "__index", lazy_index },
+			{ "__newindex", lazy_newindex },
+			{ "__len", lazy_len },
+			{ "__pairs", lazy_pairs },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, lazy_meta);
+	}
+	return 1;
+}
+
+// push a lazy table, the type byte of the table is read before
+static void
+lazy_table(lua_State *L, struct read_block *rb, int cookie) {
+	int start = rb->ptr - 1;
+	skip_value(L, rb, TYPE_TABLE, cookie);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	lua_newtable(L);
+	lazy_data(L);
+	lua_pushvalue(L, -2);
+	lua_pushlstring(L, rb->buffer + start, rb->ptr - start);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	lazy_meta(L);
+	lua_setmetatable(L, -2);
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -481,7 +708,11 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	}
 	case TYPE_TABLE: {
-		unpack_table(L,rb,cookie);
+		if (rb->lazy) {
+			lazy_table(L,rb,cookie);
+		} else {
+			unpack_table(L,rb,cookie);
+		}
 		break;
 	}
 	default: {
@@ -502,29 +733,26 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
+// the heap buffer is handed off as the message, only the stack buffer is copied.
+// the heap buffer is shrunk to the length, or the message keeps the doubled capacity while it's queued
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
+seri(lua_State *L, struct write_block *wb) {
+	char * buffer = wb->buffer;
+	if (buffer == wb->stack) {
+		buffer = skynet_malloc(wb->len);
+		memcpy(buffer, wb->stack, wb->len);
+	} else if (wb->len < wb->cap) {
+		buffer = skynet_realloc(buffer, wb->len);
 	}
-	
+	wb->buffer = wb->stack;
+
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, wb->len);
 }
 
-int
-_luaseri_unpack(lua_State *L) {
+// unpack n values at most (n < 0 for all)
+static int
+unpack(lua_State *L, int lazy, int n) {
 	if (lua_isnoneornil(L,1)) {
 		return 0;
 	}
@@ -534,9 +762,15 @@ _luaseri_unpack(lua_State *L) {
 		size_t sz;
 		 buffer = (void *)lua_tolstring(L,1,&sz);
 		len = (int)sz;
+		if (lazy) {
+			n = luaL_optinteger(L,2,-1);
+		}
 	} else {
 		buffer = lua_touserdata(L,1);
 		len = luaL_checkinteger(L,2);
+		if (lazy) {
+			n = luaL_optinteger(L,3,-1);
+		}
 	}
 	if (len == 0) {
 		return 0;
@@ -548,9 +782,10 @@ _luaseri_unpack(lua_State *L) {
 	lua_settop(L,0);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
+	rb.lazy = lazy;
 
 	int i;
-	for (i=0;;i++) {
+	for (i=0;i!=n;i++) {
 		if (i%8==7) {
 			luaL_checkstack(L,LUA_MINSTACK,NULL);
 		}
@@ -567,17 +802,29 @@ _luaseri_unpack(lua_State *L) {
 	return lua_gettop(L);
 }
 
+int
+_luaseri_unpack(lua_State *L) {
+	return unpack(L, 0, -1);
+}
+
+/*
+	The same as _luaseri_unpack, but the tables are lazy tables (decoded at the first access),
+	and an optional integer after the buffer limits the number of values to unpack.
+	The access is by the metamethods, a lazy table is empty for next, rawget and rawlen
+	before it's decoded, use pairs and the index instead.
+ */
+int
+_luaseri_lazyunpack(lua_State *L) {
+	return unpack(L, 1, -1);
+}
+
 int
 _luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
+	char temp[STACK_SIZE];
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, temp, sizeof(temp));
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
-
-	wb_free(&wb);
+	seri(L, &wb);
 
 	return 2;
 }
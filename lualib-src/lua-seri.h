@@ -5,5 +5,6 @@
 
 int _luaseri_pack(lua_State *L);
 int _luaseri_unpack(lua_State *L);
+int _luaseri_lazyunpack(lua_State *L);
 
 #endif
@@ -1,3 +1,5 @@
+#include "skynet.h"
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdint.h>
@@ -669,6 +671,27 @@ releaseobj(lua_State *L) {
 	return 0;
 }
 
+// delete the whole object when the last reference drops
+static void
+releaseshare(struct table *tbl) {
+	struct state *s = lua_touserdata(tbl->L, 1);
+	if (__sync_sub_and_fetch(&s->ref, 1) == 0) {
+		struct table *root = s->root;
+		lua_close(root->L);
+		delete_tbl(root);
+	}
+}
+
+static int
+releaseshareobj(lua_State *L) {
+	struct ctrl *c = lua_touserdata(L, 1);
+	if (c->root) {
+		releaseshare(c->root);
+		c->root = NULL;
+	}
+	return 0;
+}
+
 static int
 lboxconf(lua_State *L) {
 	struct table * tbl = get_table(L,1);	
@@ -687,6 +710,53 @@ lboxconf(lua_State *L) {
 	return 1;
 }
 
+/*
+	lightuserdata struct table *
+
+	return the box of a shared message object, it holds a reference
+	and deletes the object when the last one is collected.
+ */
+static int
+lboxshare(lua_State *L) {
+	struct table * tbl = get_table(L,1);
+	struct state * s = lua_touserdata(tbl->L, 1);
+	__sync_fetch_and_add(&s->ref, 1);
+
+	struct ctrl * c = lua_newuserdata(L, sizeof(*c));
+	c->root = tbl;
+	c->update = NULL;
+	if (luaL_newmetatable(L, "confshare")) {
+		lua_pushcfunction(L, releaseshareobj);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+// release the reference of a shared message in flight
+static int
+lreleaseshare(lua_State *L) {
+	struct table *tbl = get_table(L,1);
+	releaseshare(tbl);
+	return 0;
+}
+
+// the first value of a shared message is the struct table * packed by skynet.pack, see wb_pointer in lua-seri.c
+#define SHARE_POINTER_TAG 3	// COMBINE_TYPE(TYPE_USERDATA, 0)
+
+// release the reference of a shared message dropped by skynet, see sharemsg.send
+static void
+dropshare(void *msg, size_t sz) {
+	const uint8_t *p = msg;
+	struct table *tbl;
+	if (sz < 1 + sizeof(tbl) || p[0] != SHARE_POINTER_TAG) {
+		return;
+	}
+	memcpy(&tbl, p + 1, sizeof(tbl));
+	releaseshare(tbl);
+}
+
 static int
 lmarkdirty(lua_State *L) {
 	struct table *tbl = get_table(L,1);
@@ -782,10 +852,15 @@ luaopen_sharedata_core(lua_State *L) {
 		{ "isdirty", lisdirty },
 		{ "needupdate", lneedupdate },
 		{ "update", lupdate },
+
+		// used by shared message
+		{ "boxshare", lboxshare },
+		{ "releaseshare", lreleaseshare },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L, l);
+	skynet_drop_hook(PTYPE_RESERVED_SHARE, dropshare);
 
 	return 1;
 }
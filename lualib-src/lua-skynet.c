@@ -315,6 +315,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "harbor", _harbor },
 		{ "pack", _luaseri_pack },
 		{ "unpack", _luaseri_unpack },
+		{ "lazyunpack", _luaseri_lazyunpack },
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
 		{ "callback", _callback },
@@ -57,7 +57,7 @@ lfreepool(lua_State *L) {
 	for (i=0;i<sz;i++) {
 		struct buffer_node *node = &pool[i];
 		if (node->msg) {
-			skynet_free(node->msg);
+			skynet_socket_buffer_free(node->msg);
 			node->msg = NULL;
 		}
 	}
@@ -203,7 +203,7 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 	free_node->next = lua_touserdata(L,-1);
 	lua_pop(L,1);
 	/*free space int the lua*/
-	skynet_free(free_node->msg);
+	skynet_socket_buffer_free(free_node->msg);
 	free_node->msg = NULL;
         /*put the free_node in the array of buffer_node*/
 	free_node->sz = 0;
@@ -366,7 +366,7 @@ static int
 ldrop(lua_State *L) {
 	void * msg = lua_touserdata(L,1);
 	luaL_checkinteger(L,2);
-	skynet_free(msg);
+	skynet_socket_buffer_free(msg);
 	return 0;
 }
 
@@ -622,6 +622,16 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+static int
+lwatermark(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer high = luaL_checkinteger(L, 2);
+	lua_Integer low = luaL_optinteger(L, 3, 0);
+	skynet_socket_watermark(ctx, id, high, low);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -702,6 +712,22 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+/**
+ * @brief format the peer address of the accepted socket as "ip:port"
+ * @note the address is unformatted if socket_rawaddr is set in config
+ */
+static int
+laddress(lua_State *L) {
+	size_t sz = 0;
+	const char * addr = luaL_checklstring(L, 1, &sz);
+	char tmp[128];
+	if (skynet_socket_address(addr, (int)sz, tmp, sizeof(tmp)) == NULL) {
+		return luaL_error(L, "Invalid address");
+	}
+	lua_pushstring(L, tmp);
+	return 1;
+}
+
 /**
  * @brief register the functions for lua
  *
@@ -735,10 +761,12 @@ luaopen_socketdriver(lua_State *L) {
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "nodelay", lnodelay },
+		{ "watermark", lwatermark },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
 		{ "udp_address", ludp_address },
+		{ "address", laddress },
 		{ NULL, NULL },
 	};
 	/*put the ctx from lua in the top of the vritual stack*/
@@ -12,6 +12,7 @@ conf.host = {
 	markdirty = core.markdirty,
 	incref = core.incref,
 	decref = core.decref,
+	releaseshare = core.releaseshare,
 }
 
 local meta = {}
@@ -112,8 +113,7 @@ function conf.next(obj, key)
 	end
 end
 
-function conf.box(obj)
-	local gcobj = core.box(obj)
+local function box(obj, gcobj)
 	return setmetatable({
 		__parent = false,
 		__obj = obj,
@@ -122,6 +122,15 @@ function conf.box(obj)
 	} , meta)
 end
 
+function conf.box(obj)
+	return box(obj, core.box(obj))
+end
+
+-- the object (or a sub table of it) is deleted after the last box is collected
+function conf.boxshare(obj)
+	return box(obj, core.boxshare(obj))
+end
+
 function conf.update(self, pointer)
 	local cobj = self.__obj
 	assert(isdirty(cobj), "Only dirty object can be update")
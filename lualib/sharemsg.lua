@@ -0,0 +1,75 @@
+-- Immutable tables shared by the services of one node without serialization.
+-- sharemsg.new converts a lua table into a read-only object (like sharedata), a message of
+-- the "share" protocol carries a reference to it instead of a copy, and the receivers index it
+-- lazily. The object is deleted when the last reference (of the services or the messages) drops.
+--
+--   local sharemsg = require "sharemsg"
+--   local obj = sharemsg.new { ... }
+--   sharemsg.send(address, obj, ...)	-- the extra values are packed by skynet.pack
+--   skynet.dispatch("share", function(session, source, obj, ...) ... end)
+--
+-- The object is a pointer in the memory of the process, sharemsg.send raises an error for the
+-- services of other harbors. A message dropped by skynet (the receiver exits before dispatching it)
+-- releases its reference in the drop hook of PTYPE_SHARE, see dropshare in lua-sharedata.c.
+
+local skynet = require "skynet"
+local c = require "skynet.core"
+local sd = require "sharedata.corelib"
+
+local type = type
+local rawget = rawget
+local host = sd.host
+
+local sharemsg = {}
+
+function sharemsg.new(tbl)
+	local cobj = host.new(tbl)
+	return sd.boxshare(cobj)
+end
+
+local function local_address(addr)
+	if type(addr) == "string" then
+		addr = skynet.localname(addr) or error("Can't send a share object to " .. addr .. ", need a local name")
+	end
+	local _, remote = skynet.harbor(addr)
+	if remote then
+		error(string.format("Can't send a share object to the remote service :%08x", addr))
+	end
+	return addr
+end
+
+function sharemsg.send(addr, obj, ...)
+	addr = local_address(addr)
+	local cobj = assert(rawget(obj, "__obj"), "Need a share object")
+	local msg, sz = skynet.pack(cobj, ...)
+	-- the message holds a reference until it's unpacked or dropped. It's taken before the send,
+	-- or the drop hook may release it first and delete the object.
+	host.incref(cobj)
+	local session = c.send(addr, skynet.PTYPE_SHARE, 0, msg, sz)
+	if not session then
+		-- the address is invalid, skynet_send freed the message
+		host.releaseshare(cobj)
+	end
+	return session
+end
+
+local function unpack_share(cobj, ...)
+	local obj = sd.boxshare(cobj)
+	host.releaseshare(cobj)
+	return obj, ...
+end
+
+function sharemsg.unpack(msg, sz)
+	return unpack_share(skynet.unpack(msg, sz))
+end
+
+skynet.register_protocol {
+	name = "share",
+	id = skynet.PTYPE_SHARE,
+	pack = function()
+		error "Send a share object by sharemsg.send"
+	end,
+	unpack = sharemsg.unpack,
+}
+
+return sharemsg
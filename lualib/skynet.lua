@@ -26,6 +26,7 @@ local skynet = {
 	PTYPE_DEBUG = 9,
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
+	PTYPE_SHARE = 12,	-- used in sharemsg
 }
 
 -- code cache
@@ -122,7 +123,12 @@ local function dispatch_wakeup()
 		wakeup_session[co] = nil
 		local session = sleep_session[co]
 		if session then
-			session_id_coroutine[session] = "BREAK"
+			if c.command("CANCEL", tostring(session)) then
+				-- the timer is cancelled, no response will come
+				session_id_coroutine[session] = nil
+			else
+				session_id_coroutine[session] = "BREAK"
+			end
 			return suspend(co, coroutine.resume(co, false, "BREAK"))
 		end
 	end
@@ -247,17 +253,41 @@ function suspend(co, result, command, param, size)
 	dispatch_error_queue()
 end
 
-function skynet.timeout(ti, func)
-	local session = c.command("TIMEOUT",tostring(ti))
+local function timeout(cmd, ti, func)
+	local session = c.command(cmd,tostring(ti))
 	assert(session)
 	session = tonumber(session)
 	local co = co_create(func)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
+	return session
 end
 
-function skynet.sleep(ti)
-	local session = c.command("TIMEOUT",tostring(ti))
+function skynet.timeout(ti, func)
+	return timeout("TIMEOUT", ti, func)
+end
+
+-- the precision depends on timer_resolution in config, 10ms by default
+function skynet.timeout_ms(ms, func)
+	return timeout("TIMEOUTMS", ms, func)
+end
+
+function skynet.canceltimeout(session)
+	local co = session_id_coroutine[session]
+	if co == nil or co == "BREAK" then
+		return false
+	end
+	if c.command("CANCEL", tostring(session)) then
+		session_id_coroutine[session] = nil
+		return true
+	end
+	-- the response is in the queue already, drop it
+	session_id_coroutine[session] = "BREAK"
+	return true
+end
+
+local function sleep(cmd, ti)
+	local session = c.command(cmd,tostring(ti))
 	assert(session)
 	session = tonumber(session)
 	local succ, ret = coroutine_yield("SLEEP", session)
@@ -272,6 +302,14 @@ function skynet.sleep(ti)
 	end
 end
 
+function skynet.sleep(ti)
+	return sleep("TIMEOUT", ti)
+end
+
+function skynet.sleep_ms(ms)
+	return sleep("TIMEOUTMS", ms)
+end
+
 function skynet.yield()
 	return skynet.sleep("0")
 end
@@ -304,6 +342,11 @@ function skynet.now()
 	return tonumber(c.command("NOW"))
 end
 
+-- milliseconds since start, read from the clock rather than the timer tick
+function skynet.now_ms()
+	return tonumber(c.command("NOWMS"))
+end
+
 function skynet.starttime()
 	return tonumber(c.command("STARTTIME"))
 end
@@ -365,6 +408,9 @@ end
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
+-- The tables are decoded at the first access by index, pairs or #, they are empty for next and rawget
+-- before. A table not decoded yet is packed again as it was received.
+skynet.lazyunpack = assert(c.lazyunpack)
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
 
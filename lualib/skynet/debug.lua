@@ -26,6 +26,8 @@ function dbgcmd.STAT()
 	local stat = {}
 	stat.mqlen = skynet.mqlen()
 	stat.task = skynet.task()
+	local arena = package.loaded["skynet.arena"]
+	stat.arena = arena and arena.stat()
 	skynet.ret(skynet.pack(stat))
 end
 
@@ -20,6 +20,18 @@ function skynet.abort()
 	c.command("ABORT")
 end
 
+-- set priority class of current service : "high", "normal" or "low", return current one
+-- a high priority service runs first, at most 4 times in a row before a normal one (see examples/config)
+function skynet.priority(class)
+	return c.command("PRIORITY", class or "")
+end
+
+-- bind current service to a numa node (config numa = true), -1 for any node
+-- only the workers of the node run the service after it, its memory is not moved to the node
+function skynet.numa(node)
+	return c.command("NUMA", tostring(node)) ~= nil
+end
+
 local function globalname(name, handle)
 	local c = string.sub(name,1,1)
 	assert(c ~= ':')
@@ -114,6 +114,13 @@ function gateserver.start(handler)
 		close_fd(fd)
 	end
 
+	-- size is the KB wait to send when reaches the high watermark (see socketdriver.watermark), 0 when drained
+	function MSG.warning(fd, size)
+		if handler.warning then
+			handler.warning(fd, size)
+		end
+	end
+
 	skynet.register_protocol {
 		name = "socket",
 		id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -1,6 +1,5 @@
 local driver = require "socketdriver"
 local skynet = require "skynet"
-local skynet_core = require "skynet.core"
 local assert = assert
 
 local socket = {}	-- api
@@ -38,6 +37,16 @@ local function suspend(s)
 	end
 end
 
+local function wakeup_drain(s)
+	local waiting = s.drain_wait
+	if waiting then
+		s.drain_wait = nil
+		for _, co in ipairs(waiting) do
+			skynet.wakeup(co)
+		end
+	end
+end
+
 -- read skynet_socket.h for these macro
 -- SKYNET_SOCKET_TYPE_DATA = 1
 socket_message[1] = function(id, size, data)
@@ -93,6 +102,7 @@ socket_message[3] = function(id)
 	end
 	s.connected = false
 	wakeup(s)
+	wakeup_drain(s)
 end
 
 -- SKYNET_SOCKET_TYPE_ACCEPT = 4
@@ -118,6 +128,7 @@ socket_message[5] = function(id)
 	s.connected = false
 
 	wakeup(s)
+	wakeup_drain(s)
 end
 
 -- SKYNET_SOCKET_TYPE_UDP = 6
@@ -129,10 +140,30 @@ socket_message[6] = function(id, size, data, address)
 		return
 	end
 	local str = skynet.tostring(data, size)
-	skynet_core.trash(data, size)
+	driver.drop(data, size)
 	s.callback(str, address)
 end
 
+-- SKYNET_SOCKET_TYPE_WARNING = 7
+socket_message[7] = function(id, size)
+	local s = socket_pool[id]
+	if s == nil then
+		return
+	end
+	-- size is the KB wait to send when reaches the high watermark, 0 when falls to the low watermark
+	if size > 0 then
+		s.warning = size
+	else
+		s.warning = nil
+	end
+	if s.on_warning then
+		s.on_warning(id, size)
+	end
+	if size == 0 then
+		wakeup_drain(s)
+	end
+end
+
 skynet.register_protocol {
 	name = "socket",
 	id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -369,6 +400,37 @@ function socket.limit(id, limit)
 	s.buffer_limit = limit
 end
 
+-- the socket thread reports when the bytes wait to send reach high, and when they fall to low.
+-- high = 0 for disable
+function socket.watermark(id, high, low)
+	driver.watermark(id, high, low or 0)
+end
+
+-- callback(id, size) is called when the watermarks are crossed, size is the KB wait to send, 0 for drained
+function socket.warning(id, callback)
+	local s = assert(socket_pool[id])
+	s.on_warning = callback
+end
+
+-- block the producer while the bytes wait to send are above the watermark, return false if the socket is closed
+function socket.drain(id)
+	local s = socket_pool[id]
+	if s == nil or not s.connected then
+		return false
+	end
+	if s.warning then
+		local waiting = s.drain_wait
+		if waiting == nil then
+			waiting = {}
+			s.drain_wait = waiting
+		end
+		local co = coroutine.running()
+		table.insert(waiting, co)
+		skynet.wait()
+	end
+	return s.connected
+end
+
 ---------------------- UDP
 
 local udp_socket = {}
@@ -403,5 +465,7 @@ end
 
 socket.sendto = assert(driver.udp_send)
 socket.udp_address = assert(driver.udp_address)
+-- the address passed to the accept callback, it's unformatted if socket_rawaddr is set in config
+socket.address = assert(driver.address)
 
 return socket
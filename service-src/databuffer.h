@@ -1,6 +1,8 @@
 #ifndef skynet_databuffer_h
 #define skynet_databuffer_h
 
+#include "skynet_socket.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -54,7 +56,8 @@ _return_message(struct databuffer *db, struct messagepool *mp) {
 	} else {
 		db->head = m->next;
 	}
-	skynet_free(m->buffer);
+	// buffer is the payload of socket message
+	skynet_socket_buffer_free(m->buffer);
 	m->buffer = NULL;
 	m->size = 0;
 	m->next = mp->freelist;
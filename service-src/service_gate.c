@@ -215,7 +215,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		} else {
 			skynet_error(ctx, "Drop unknown connection %d message", message->id);
 			skynet_socket_close(ctx, message->id);
-			skynet_free(message->buffer);
+			skynet_socket_buffer_free(message->buffer);
 		}
 		break;
 	}
@@ -227,7 +227,11 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		int id = hashid_lookup(&g->hash, message->id);
 		if (id>=0) {
 			struct connection *c = &g->conn[id];
-			_report(g, "%d open %d %s:0",message->id,message->id,c->remote_name);
+			char addr[64];
+			if (skynet_socket_address(c->remote_name, sizeof(c->remote_name) - 1, addr, sizeof(addr)) == NULL) {
+				addr[0] = '\0';
+			}
+			_report(g, "%d open %d %s:0",message->id,message->id,addr);
 		} else {
 			skynet_error(ctx, "Close unknown connection %d", message->id);
 			skynet_socket_close(ctx, message->id);
@@ -257,6 +261,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 				sz = sizeof(c->remote_name) - 1;
 			}
 			c->id = message->ud;
+			// it may be unformatted (socket_rawaddr), format it when reported
 			memcpy(c->remote_name, message+1, sz);
 			c->remote_name[sz] = '\0';
 			skynet_socket_start(ctx, message->ud);
@@ -9,11 +9,178 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#define ARENA_ALIGN 16
+#define ARENA_CLASS 16              /*size class n holds blocks of (n+1) * ARENA_ALIGN bytes, larger ones use skynet_realloc*/
+#define ARENA_MIN_CHUNK (8 * 1024)  /*size of the first chunk, it doubles up to ARENA_MAX_CHUNK*/
+#define ARENA_MAX_CHUNK (64 * 1024)
+
+struct arena_block {
+	struct arena_block * next;
+};
+
+struct arena_chunk {
+	struct arena_chunk * next;
+	size_t size;
+};
+
+// the chunk head is padded, so the blocks carved after it are aligned
+#define ARENA_CHUNK_HEAD ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/**
+ * @brief allocator of a lua state, only the thread running the service uses it
+ */
+struct arena {
+	struct arena_block * free[ARENA_CLASS]; /*free blocks of each size class*/
+	struct arena_chunk * chunk;             /*all chunks, freed at once when the service exits*/
+	char * ptr;                             /*room left in the last chunk*/
+	char * end;
+	size_t chunk_size;                      /*bytes of all chunks*/
+	size_t used;                            /*bytes of small blocks in use*/
+	size_t large;                           /*bytes of large blocks in use*/
+};
+
 struct snlua {
 	lua_State * L;
 	struct skynet_context * ctx;
+	struct arena * arena;       /*NULL if lua_arena is not set, use skynet_lalloc*/
 };
 
+static inline int
+arena_class(size_t sz) {
+	int c = (int)((sz + ARENA_ALIGN - 1) / ARENA_ALIGN) - 1;
+	return c < ARENA_CLASS ? c : -1;
+}
+
+static void *
+arena_alloc(struct arena *a, size_t sz) {
+	int c = arena_class(sz);
+	if (c < 0) {
+		a->large += sz;
+		return skynet_malloc(sz);
+	}
+	size_t bsz = (size_t)(c + 1) * ARENA_ALIGN;
+	a->used += bsz;
+	struct arena_block *b = a->free[c];
+	if (b) {
+		a->free[c] = b->next;
+		return b;
+	}
+	if (a->ptr + bsz > a->end) {
+		// the room left in the last chunk is dropped
+		size_t csz = a->chunk ? a->chunk->size * 2 : ARENA_MIN_CHUNK;
+		if (csz > ARENA_MAX_CHUNK) {
+			csz = ARENA_MAX_CHUNK;
+		}
+		struct arena_chunk *chunk = skynet_malloc(csz);
+		chunk->next = a->chunk;
+		chunk->size = csz;
+		a->chunk = chunk;
+		a->chunk_size += csz;
+		a->ptr = (char *)chunk + ARENA_CHUNK_HEAD;
+		a->end = (char *)chunk + csz;
+	}
+	void * ret = a->ptr;
+	a->ptr += bsz;
+	return ret;
+}
+
+static void
+arena_free(struct arena *a, void *ptr, size_t sz) {
+	int c = arena_class(sz);
+	if (c < 0) {
+		a->large -= sz;
+		skynet_free(ptr);
+		return;
+	}
+	a->used -= (size_t)(c + 1) * ARENA_ALIGN;
+	struct arena_block *b = ptr;
+	b->next = a->free[c];
+	a->free[c] = b;
+}
+
+/**
+ * @brief lua_Alloc of the lua state with arena, osize is the size of ptr if it's not NULL
+ */
+static void *
+arena_lalloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	struct arena *a = ud;
+	if (ptr == NULL) {
+		// osize is the type of the object
+		return nsize ? arena_alloc(a, nsize) : NULL;
+	}
+	if (nsize == 0) {
+		arena_free(a, ptr, osize);
+		return NULL;
+	}
+	int oc = arena_class(osize);
+	int nc = arena_class(nsize);
+	if (oc >= 0 && oc == nc) {
+		return ptr;
+	}
+	if (oc < 0 && nc < 0) {
+		a->large += nsize - osize;
+		return skynet_realloc(ptr, nsize);
+	}
+	void * ret = arena_alloc(a, nsize);
+	memcpy(ret, ptr, osize < nsize ? osize : nsize);
+	arena_free(a, ptr, osize);
+	return ret;
+}
+
+static struct arena *
+arena_new(void) {
+	struct arena * a = skynet_malloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	return a;
+}
+
+/**
+ * @brief free all the chunks, the blocks not freed by lua_close are freed with them
+ */
+static void
+arena_delete(struct arena *a) {
+	struct arena_chunk *c = a->chunk;
+	while (c) {
+		struct arena_chunk *next = c->next;
+		skynet_free(c);
+		c = next;
+	}
+	skynet_free(a);
+}
+
+static int
+larena_stat(lua_State *L) {
+	struct arena *a = lua_touserdata(L, lua_upvalueindex(1));
+	if (a == NULL) {
+		return 0;
+	}
+	lua_createtable(L, 0, 3);
+	lua_pushinteger(L, (lua_Integer)a->chunk_size);
+	lua_setfield(L, -2, "chunk");
+	lua_pushinteger(L, (lua_Integer)a->used);
+	lua_setfield(L, -2, "used");
+	lua_pushinteger(L, (lua_Integer)a->large);
+	lua_setfield(L, -2, "large");
+	return 1;
+}
+
+/**
+ * @brief skynet.arena.stat() returns { chunk, used, large } in bytes, or nil if lua_arena is not set
+ */
+static int
+arena_lib(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "stat", larena_stat },
+		{ NULL, NULL },
+	};
+	luaL_newlibtable(L, l);
+	void *ud = NULL;
+	lua_Alloc f = lua_getallocf(L, &ud);
+	lua_pushlightuserdata(L, f == arena_lalloc ? ud : NULL);
+	luaL_setfuncs(L, l, 1);
+	return 1;
+}
+
 // LUA_CACHELIB may defined in patched lua for shared proto
 #ifdef LUA_CACHELIB
 
@@ -78,6 +245,8 @@ _init(struct snlua *l, struct skynet_context *ctx, const char * args, size_t sz)
 	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_context");
 	luaL_requiref(L, "skynet.codecache", codecache , 0);
 	lua_pop(L,1);
+	luaL_requiref(L, "skynet.arena", arena_lib , 0);
+	lua_pop(L,1);
 
 	const char *path = optstring(ctx, "lua_path","./lualib/?.lua;./lualib/?/init.lua");
 	lua_pushstring(L, path);
@@ -147,13 +316,22 @@ struct snlua *
 snlua_create(void) {
 	struct snlua * l = skynet_malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
-	l->L = lua_newstate(skynet_lalloc, NULL);
+	const char * arena = skynet_command(NULL, "GETENV", "lua_arena");
+	if (arena && strcmp(arena, "true") == 0) {
+		l->arena = arena_new();
+		l->L = lua_newstate(arena_lalloc, l->arena);
+	} else {
+		l->L = lua_newstate(skynet_lalloc, NULL);
+	}
 	return l;
 }
 
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	if (l->arena) {
+		arena_delete(l->arena);
+	}
 	skynet_free(l);
 }
 
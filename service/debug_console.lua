@@ -130,6 +130,8 @@ function COMMAND.help()
 		log = "launch a new lua service with log",
 		debug = "debug address : debug a lua service",
 		signal = "signal address sig",
+		park = "park : show worker parking counters",
+		netbuf = "netbuf : show socket receive buffer pool counters",
 	}
 end
 
@@ -257,3 +259,20 @@ function COMMAND.signal(address, sig)
 		core.command("SIGNAL", address)
 	end
 end
+
+function COMMAND.park()
+	local result = {}
+	for _, name in ipairs { "park", "wakeup", "spurious", "spin" } do
+		result[name] = tonumber(core.command("STAT", name))
+	end
+	return result
+end
+
+function COMMAND.netbuf()
+	local result = {}
+	for _, name in ipairs { "alloc", "hit", "inflight", "slab" } do
+		result[name] = tonumber(core.command("STAT", "netbuf_" .. name))
+	end
+	result.hitrate = string.format("%.2f%%", result.alloc > 0 and result.hit * 100 / result.alloc or 0)
+	return result
+end
@@ -5,83 +5,202 @@
 
 #include "malloc_hook.h"
 #include "skynet.h"
+#include "skynet_handle.h"
+#include "skynet_server.h"
+
+#define PREFIX_SIZE sizeof(struct malloc_stat *)
+#define MAX_SHARD 256       /*threads count into their own shard, the others share the last one*/
+#define REMOTE_SIZE 16      /*services a thread caches the frees for*/
+#define REMOTE_FLUSH 1024   /*fold the cached frees into the services after so many frees*/
+
+/**
+ * @brief memory counters of one thread, folded when read
+ */
+struct mem_shard {
+	ssize_t used;           /*only the owner thread changes it, except the shared shard*/
+	ssize_t block;
+	char pad[64 - 2 * sizeof(ssize_t)];  /*one cache line for each thread*/
+};
+
+/**
+ * @brief bytes of a service freed by this thread and not folded into its malloc_stat yet
+ */
+struct mem_remote {
+	struct malloc_stat *stat;   /*NULL for empty*/
+	ssize_t freed;
+};
+
+static struct mem_shard M_shard[MAX_SHARD + 1];
+static __thread struct malloc_stat * M_stat = NULL;     /*memory counter of the service running on this thread*/
+
+/**
+ * @brief set the service running on this thread, its memory is counted in stat
+ * @param[in] stat counter of the service, NULL for none
+ */
+void
+malloc_current(struct malloc_stat *stat) {
+	M_stat = stat;
+}
 
-static size_t _used_memory = 0;
-static size_t _memory_block = 0;
-typedef struct _mem_data {
-	uint32_t handle;
-	ssize_t allocated;
-} mem_data;
+/**
+ * @brief get the service running on this thread, to restore it after malloc_current
+ */
+struct malloc_stat *
+malloc_current_get(void) {
+	return M_stat;
+}
 
-#define SLOT_SIZE 0x10000
-#define PREFIX_SIZE sizeof(uint32_t)
+#ifndef NOUSE_JEMALLOC
 
-static mem_data mem_stats[SLOT_SIZE];
+#include "jemalloc.h"
 
+static int M_shard_n = 0;
+static __thread struct mem_shard * M_self = NULL;
+static __thread struct mem_remote M_remote[REMOTE_SIZE];
+static __thread int M_remote_n = 0;                     /*frees cached since the last flush*/
+
+static void malloc_oom(size_t size);
+
+/**
+ * @brief new memory counter for a service
+ * @note it isn't counted in any service, since it may live longer than the service
+ */
+struct malloc_stat *
+malloc_stat_new(void) {
+	struct malloc_stat *stat = je_malloc(sizeof(*stat));
+	if (stat == NULL) malloc_oom(sizeof(*stat));
+	stat->local = 0;
+	stat->remote = 0;
+	return stat;
+}
 
-#ifndef NOUSE_JEMALLOC
+/**
+ * @brief add the bytes freed by other thread, free the counter when the last byte of a released service is freed
+ * @note remote > 0 before the release, so it's 0 only after the release when nothing is left
+ */
+static inline void
+stat_fold(struct malloc_stat *stat, ssize_t freed) {
+	if (__sync_add_and_fetch(&stat->remote, freed) == 0) {
+		je_free(stat);
+	}
+}
 
-#include "jemalloc.h"
+/**
+ * @brief the service is released, the counter is freed after its blocks left are freed
+ * @note a service leaking memory keeps its counter, it's small beside the leak
+ */
+void
+malloc_stat_release(struct malloc_stat *stat) {
+	if (M_stat == stat) {
+		M_stat = NULL;
+	}
+	// local doesn't change any more, the frees after this go to remote
+	stat_fold(stat, -stat->local);
+}
+
+/**
+ * @brief the shard of this thread, assigned at the first use
+ */
+static inline struct mem_shard *
+shard_self(void) {
+	struct mem_shard *s = M_self;
+	if (s == NULL) {
+		int id = __sync_fetch_and_add(&M_shard_n, 1);
+		s = M_self = &M_shard[id < MAX_SHARD ? id : MAX_SHARD];
+	}
+	return s;
+}
+
+inline static void
+update_shard(ssize_t n, ssize_t block) {
+	struct mem_shard *s = shard_self();
+	if (s == &M_shard[MAX_SHARD]) {
+		__sync_add_and_fetch(&s->used, n);
+		__sync_add_and_fetch(&s->block, block);
+	} else {
+		s->used += n;
+		s->block += block;
+	}
+}
 
-static ssize_t*
-get_allocated_field(uint32_t handle) {
-	int h = (int)(handle & (SLOT_SIZE - 1));
-	mem_data *data = &mem_stats[h];
-	uint32_t old_handle = data->handle;
-	ssize_t old_alloc = data->allocated;
-	if(old_handle == 0 || old_alloc <= 0) {
-		// data->allocated may less than zero, because it may not count at start.
-		if(!__sync_bool_compare_and_swap(&data->handle, old_handle, handle)) {
-			return 0;
+static void
+remote_fold(struct mem_remote *r) {
+	stat_fold(r->stat, r->freed);
+	r->stat = NULL;
+	r->freed = 0;
+}
+
+/**
+ * @brief fold the frees cached by this thread, the worker calls it before it parks
+ */
+void
+malloc_flush(void) {
+	int i;
+	for (i=0;i<REMOTE_SIZE;i++) {
+		if (M_remote[i].stat) {
+			remote_fold(&M_remote[i]);
 		}
-		if (old_alloc < 0) {
-			__sync_bool_compare_and_swap(&data->allocated, old_alloc, 0);
+	}
+	M_remote_n = 0;
+}
+
+/**
+ * @brief count the memory of other service freed by this thread
+ */
+static void
+remote_free(struct malloc_stat *stat, size_t __n) {
+	struct mem_remote *r = &M_remote[((uintptr_t)stat / sizeof(*stat)) % REMOTE_SIZE];
+	if (r->stat != stat) {
+		if (r->stat) {
+			remote_fold(r);
 		}
+		r->stat = stat;
 	}
-	if(data->handle != handle) {
-		return 0;
+	r->freed += __n;
+	if (++M_remote_n >= REMOTE_FLUSH) {
+		malloc_flush();
 	}
-	return &data->allocated;
 }
 
 inline static void 
-update_xmalloc_stat_alloc(uint32_t handle, size_t __n) {
-	__sync_add_and_fetch(&_used_memory, __n);
-	__sync_add_and_fetch(&_memory_block, 1); 
-	ssize_t* allocated = get_allocated_field(handle);
-	if(allocated) {
-		__sync_add_and_fetch(allocated, __n);
+update_xmalloc_stat_alloc(struct malloc_stat *stat, size_t __n) {
+	update_shard(__n, 1);
+	if (stat) {
+		stat->local += __n;
 	}
 }
 
 inline static void
-update_xmalloc_stat_free(uint32_t handle, size_t __n) {
-	__sync_sub_and_fetch(&_used_memory, __n);
-	__sync_sub_and_fetch(&_memory_block, 1);
-	ssize_t* allocated = get_allocated_field(handle);
-	if(allocated) {
-		__sync_sub_and_fetch(allocated, __n);
+update_xmalloc_stat_free(struct malloc_stat *stat, size_t __n) {
+	update_shard(-(ssize_t)__n, -1);
+	if (stat == NULL) {
+		return;
+	}
+	if (stat == M_stat) {
+		stat->local -= __n;
+	} else {
+		remote_free(stat, __n);
 	}
 }
 
 inline static void*
 fill_prefix(char* ptr) {
-	uint32_t handle = skynet_current_handle();
+	struct malloc_stat *stat = M_stat;
 	size_t size = je_malloc_usable_size(ptr);
-	uint32_t *p = (uint32_t *)(ptr + size - sizeof(uint32_t));
-	memcpy(p, &handle, sizeof(handle));
+	struct malloc_stat **p = (struct malloc_stat **)(ptr + size - PREFIX_SIZE);
+	memcpy(p, &stat, sizeof(stat));
 
-	update_xmalloc_stat_alloc(handle, size);
+	update_xmalloc_stat_alloc(stat, size);
 	return ptr;
 }
 
 inline static void*
 clean_prefix(char* ptr) {
 	size_t size = je_malloc_usable_size(ptr);
-	uint32_t *p = (uint32_t *)(ptr + size - sizeof(uint32_t));
-	uint32_t handle;
-	memcpy(&handle, p, sizeof(handle));
-	update_xmalloc_stat_free(handle, size);
+	struct malloc_stat **p = (struct malloc_stat **)(ptr + size - PREFIX_SIZE);
+	struct malloc_stat *stat;
+	memcpy(&stat, p, sizeof(stat));
+	update_xmalloc_stat_free(stat, size);
 	return ptr;
 }
 
@@ -163,6 +282,26 @@ skynet_calloc(size_t nmemb,size_t size) {
 
 #else
 
+struct malloc_stat *
+malloc_stat_new(void) {
+	struct malloc_stat *stat = skynet_malloc(sizeof(*stat));
+	stat->local = 0;
+	stat->remote = 0;
+	return stat;
+}
+
+void
+malloc_stat_release(struct malloc_stat *stat) {
+	if (M_stat == stat) {
+		M_stat = NULL;
+	}
+	skynet_free(stat);
+}
+
+void
+malloc_flush(void) {
+}
+
 void 
 memory_info_dump(void) {
 	skynet_error(NULL, "No jemalloc");
@@ -184,26 +323,54 @@ mallctl_opt(const char* name, int* newval) {
 
 size_t
 malloc_used_memory(void) {
-	return _used_memory;
+	ssize_t used = 0;
+	int i;
+	for (i=0;i<=MAX_SHARD;i++) {
+		used += M_shard[i].used;
+	}
+	return used > 0 ? used : 0;
 }
 
 size_t
 malloc_memory_block(void) {
-	return _memory_block;
+	ssize_t block = 0;
+	int i;
+	for (i=0;i<=MAX_SHARD;i++) {
+		block += M_shard[i].block;
+	}
+	return block > 0 ? block : 0;
+}
+
+/**
+ * @brief memory of the service running on this thread
+ */
+size_t
+malloc_current_memory(void) {
+	if (M_stat == NULL) {
+		return 0;
+	}
+	malloc_flush();
+	ssize_t used = M_stat->local - M_stat->remote;
+	return used > 0 ? used : 0;
+}
+
+static void
+dump_context(struct skynet_context *ctx, void *ud) {
+	size_t *total = ud;
+	struct malloc_stat *stat = skynet_context_memory(ctx);
+	uint32_t handle = skynet_context_handle(ctx);
+	ssize_t used = stat->local - stat->remote;
+	if (used > 0) {
+		*total += used;
+		skynet_error(NULL, "0x%x -> %zdkb", handle, used >> 10);
+	}
 }
 
 void
 dump_c_mem() {
-	int i;
 	size_t total = 0;
 	skynet_error(NULL, "dump all service mem:");
-	for(i=0; i<SLOT_SIZE; i++) {
-		mem_data* data = &mem_stats[i];
-		if(data->handle != 0 && data->allocated != 0) {
-			total += data->allocated;
-			skynet_error(NULL, "0x%x -> %zdkb", data->handle, data->allocated >> 10);
-		}
-	}
+	skynet_handle_foreach(dump_context, &total);
 	skynet_error(NULL, "+total: %zdkb",total >> 10);
 }
 
@@ -2,9 +2,26 @@
 #define SKYNET_MALLOC_HOOK_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
 
+/**
+ * @brief memory of a service, its context and its blocks point to it
+ * @note it lives until the service is released and all its blocks are freed, see malloc_stat_release
+ */
+struct malloc_stat {
+	ssize_t local;      /*allocated minus freed by the service, only the thread running the service changes it*/
+	ssize_t remote;     /*freed by the other threads, atomic add, minus local after the service is released*/
+};
+
+extern struct malloc_stat * malloc_stat_new(void);
+extern void   malloc_stat_release(struct malloc_stat *stat);
+extern void   malloc_current(struct malloc_stat *stat);
+extern struct malloc_stat * malloc_current_get(void);
+extern void   malloc_flush(void);
 extern size_t malloc_used_memory(void);
 extern size_t malloc_memory_block(void);
+extern size_t malloc_current_memory(void);
 extern void   memory_info_dump(void);
 extern size_t mallctl_int64(const char* name, size_t* newval);
 extern int    mallctl_opt(const char* name, int* newval);
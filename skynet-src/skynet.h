@@ -21,6 +21,8 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+// read lualib/sharemsg.lua
+#define PTYPE_RESERVED_SHARE 12
 
 #define PTYPE_TAG_DONTCOPY 0x10000     /*don't free payload*/ 
 #define PTYPE_TAG_ALLOCSESSION 0x20000 /*use session id not used*/
@@ -38,6 +40,10 @@ int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
 
+// release what a message holds when skynet drops it undelivered (the receiver exits), the message is freed after it
+typedef void (*skynet_drop_cb)(void * msg, size_t sz);
+void skynet_drop_hook(int type, skynet_drop_cb cb);
+
 uint32_t skynet_current_handle(void);
 
 #endif
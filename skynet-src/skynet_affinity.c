@@ -0,0 +1,122 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "skynet.h"
+
+#include "skynet_affinity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define MAX_NODE 64
+
+/**
+ * @brief parse a cpu list like "0,2,4-7"
+ * @param[in] list cpu list string
+ * @param[out] cpus cpu ids
+ * @param[in] max size of cpus
+ * @return num of cpus, -1 for invalid list
+ */
+int
+skynet_affinity_parse(const char * list, int * cpus, int max) {
+	int n = 0;
+	const char * p = list;
+	while (*p) {
+		char * end;
+		long from = strtol(p, &end, 10);
+		if (end == p || from < 0) {
+			return -1;
+		}
+		long to = from;
+		p = end;
+		if (*p == '-') {
+			++p;
+			to = strtol(p, &end, 10);
+			if (end == p || to < from) {
+				return -1;
+			}
+			p = end;
+		}
+		long i;
+		for (i=from;i<=to && n<max;i++) {
+			cpus[n++] = (int)i;
+		}
+		while (*p == ',' || *p == ' ' || *p == '\n') {
+			++p;
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief pin current thread on one cpu
+ * @param[in] cpu cpu id
+ * @return 0 for success
+ */
+int
+skynet_affinity_bind(int cpu) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+		skynet_error(NULL, "Set thread affinity to cpu %d failed", cpu);
+		return 1;
+	}
+	return 0;
+#else
+	skynet_error(NULL, "Thread affinity is not supported on this platform");
+	return 1;
+#endif
+}
+
+/**
+ * @brief get numa node of cpu by /sys/devices/system/node
+ * @param[in] cpu cpu id
+ * @return node id, 0 when the topology is unknown
+ */
+int
+skynet_affinity_node(int cpu) {
+#if defined(__linux__)
+	int node;
+	for (node=0;node<MAX_NODE;node++) {
+		char path[64];
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (f == NULL) {
+			continue;
+		}
+		char line[1024];
+		int cpus[1024];
+		int n = 0;
+		if (fgets(line, sizeof(line), f)) {
+			n = skynet_affinity_parse(line, cpus, sizeof(cpus)/sizeof(cpus[0]));
+		}
+		fclose(f);
+		int i;
+		for (i=0;i<n;i++) {
+			if (cpus[i] == cpu) {
+				return node;
+			}
+		}
+	}
+#endif
+	return 0;
+}
+
+/**
+ * @brief num of online cpus
+ */
+int
+skynet_affinity_ncpu(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
@@ -0,0 +1,9 @@
+#ifndef SKYNET_AFFINITY_H
+#define SKYNET_AFFINITY_H
+
+int skynet_affinity_parse(const char * list, int * cpus, int max);	// "0,2,4-7", return num of cpus
+int skynet_affinity_bind(int cpu);	// pin current thread, 0 for success
+int skynet_affinity_node(int cpu);	// numa node of cpu
+int skynet_affinity_ncpu(void);
+
+#endif
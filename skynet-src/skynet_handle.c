@@ -7,17 +7,58 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <sched.h>
 
 #define DEFAULT_SLOT_SIZE 4
 #define MAX_SLOT_SIZE 0x40000000
+#define DEFAULT_NAME_SIZE 16
+#define MAX_READER 256          /*threads can grab without lock, others fall back to rwlock*/
+
+/**
+ * @brief slots of handle, replaced as a whole when it grows
+ *
+ */
+struct handle_slot {
+	int size;                         /*slot tot size*/
+	struct skynet_context * ctx[1];   /*slots used to store handle*/
+};
+
+#ifndef HANDLE_RWLOCK
+
+/**
+ * @brief read side of one thread, seq is odd when the thread is reading slots
+ *
+ */
+struct handle_reader {
+	uint32_t seq;
+	char pad[64 - sizeof(uint32_t)];  /*one cache line for each thread*/
+};
+
+static struct handle_reader R[MAX_READER];
+static int R_count = 0;
+static __thread int R_id = -1;        /*-1 for unassigned, MAX_READER for use rwlock*/
+
+#endif
 
 /**
  * @brief structure of modules registered 
  *
  */
 struct handle_name {
-	char * name;            /*name of the module*/
-	uint32_t handle;        /*id of the module*/
+	char * name;                /*name of the module, interned*/
+	uint32_t handle;            /*id of the module*/
+	uint32_t hash;              /*hash of the name*/
+	struct handle_name * next;  /*next name in the same bucket*/
+	struct handle_name * retired; /*link of the removed names, next is kept for the readers*/
+};
+
+/**
+ * @brief hash index of names, replaced as a whole when it grows
+ *
+ */
+struct handle_name_table {
+	int size;                          /*bucket tot size*/
+	struct handle_name * bucket[1];
 };
 
 /**
@@ -29,16 +70,84 @@ struct handle_storage {
 
 	uint32_t harbor;                /*harbor id*/
 	uint32_t handle_index;          
-	int slot_size;                  /*slot tot size*/
-	struct skynet_context ** slot;  /*slots used to store handle*/ 
+	struct handle_slot * slot;      /*slots used to store handle, read without lock*/ 
 	
-	int name_cap;                   /*space used to store name of module*/
 	int name_count;                 /*module name stored in table*/
-	struct handle_name *name;       /*store the handle name*/
+	struct handle_name_table *name; /*store the handle name, read without lock*/
+	uint32_t name_version;          /*increased when any name is removed*/
 };
 
 static struct handle_storage *H = NULL; /*one handle_storage only*/
 
+#ifndef HANDLE_RWLOCK
+
+/**
+ * @brief enter the read side, return 1 if the thread falls back to rwlock
+ */
+static inline int
+reader_enter(struct handle_storage *s) {
+	int id = R_id;
+	if (id < 0) {
+		id = __sync_fetch_and_add(&R_count, 1);
+		if (id >= MAX_READER) {
+			id = MAX_READER;
+		}
+		R_id = id;
+	}
+	if (id == MAX_READER) {
+		rwlock_rlock(&s->lock);
+		return 1;
+	}
+	R[id].seq++;
+	__sync_synchronize();
+	return 0;
+}
+
+static inline void
+reader_leave(struct handle_storage *s, int locked) {
+	if (locked) {
+		rwlock_runlock(&s->lock);
+	} else {
+		__sync_synchronize();
+		R[R_id].seq++;
+	}
+}
+
+/**
+ * @brief wait for all threads leave the read side they have entered
+ * @note call it with the write lock, after unlink the slots or the context
+ */
+static void
+reader_synchronize() {
+	__sync_synchronize();
+	int n = R_count < MAX_READER ? R_count : MAX_READER;
+	int i;
+	for (i=0;i<n;i++) {
+		uint32_t seq = R[i].seq;
+		if (seq & 1) {
+			while (*(volatile uint32_t *)&R[i].seq == seq) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+#else
+
+#define reader_enter(s) (rwlock_rlock(&(s)->lock), 1)
+#define reader_leave(s, locked) ((void)(locked), rwlock_runlock(&(s)->lock))
+#define reader_synchronize()
+
+#endif
+
+static struct handle_slot *
+slot_new(int size) {
+	struct handle_slot * slot = skynet_malloc(sizeof(*slot) + (size - 1) * sizeof(struct skynet_context *));
+	slot->size = size;
+	memset(slot->ctx, 0, size * sizeof(struct skynet_context *));
+	return slot;
+}
+
 /**
  * @brief register the module into the storage
  * @param[in] ctx manager of the module
@@ -50,13 +159,15 @@ skynet_handle_register(struct skynet_context *ctx) {
 	rwlock_wlock(&s->lock);
 	
 	for (;;) {
+		struct handle_slot *slot = s->slot;
 		int i;
 		/*lookup the empty slot*/
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;i<slot->size;i++) {
 			uint32_t handle = (i+s->handle_index) & HANDLE_MASK;
-			int hash = handle & (s->slot_size-1);
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			int hash = handle & (slot->size-1);
+			if (slot->ctx[hash] == NULL) {
+				__sync_synchronize();
+				slot->ctx[hash] = ctx;
 				s->handle_index = handle + 1;
 
 				rwlock_wunlock(&s->lock);
@@ -66,17 +177,18 @@ skynet_handle_register(struct skynet_context *ctx) {
 			}
 		}
 		/*double it's size*/
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];
+		assert((slot->size*2 - 1) <= HANDLE_MASK);
+		struct handle_slot * new_slot = slot_new(slot->size * 2);
+		for (i=0;i<slot->size;i++) {
+			int hash = skynet_context_handle(slot->ctx[i]) & (new_slot->size - 1);
+			assert(new_slot->ctx[hash] == NULL);
+			new_slot->ctx[hash] = slot->ctx[i];
 		}
-		skynet_free(s->slot);
+		__sync_synchronize();
 		s->slot = new_slot;
-		s->slot_size *= 2;
+		/*the readers may still use the old slots*/
+		reader_synchronize();
+		skynet_free(slot);
 	}
 }
 
@@ -93,24 +205,42 @@ skynet_handle_retire(uint32_t handle) {
 
 	rwlock_wlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		slot->ctx[hash] = NULL;
 		ret = 1;
+		struct handle_name *removed = NULL;
+		struct handle_name_table *t = s->name;
 		int i;
-		int j=0, n=s->name_count;
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
+		for (i=0; i<t->size; ++i) {
+			struct handle_name **pn = &t->bucket[i];
+			while (*pn) {
+				struct handle_name *n = *pn;
+				if (n->handle == handle) {
+					// the readers on n still follow n->next to the rest of the bucket
+					*pn = n->next;
+					n->retired = removed;
+					removed = n;
+					--s->name_count;
+				} else {
+					pn = &n->next;
+				}
 			}
-			++j;
 		}
-		s->name_count = j;
+		if (removed) {
+			__sync_add_and_fetch(&s->name_version, 1);
+		}
+		/*the readers which have read ctx (or names) finish before we release it*/
+		reader_synchronize();
+		while (removed) {
+			struct handle_name *n = removed;
+			removed = n->retired;
+			skynet_free(n->name);
+			skynet_free(n);
+		}
 	} else {
 		ctx = NULL;
 	}
@@ -134,9 +264,9 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;i<s->slot->size;i++) {
 			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+			struct skynet_context * ctx = s->slot->ctx[i];
 			uint32_t handle = 0;
 			if (ctx)
 				handle = skynet_context_handle(ctx);
@@ -152,96 +282,139 @@ skynet_handle_retireall() {
 	}
 }
 
+/**
+ * @brief call f for every module, the context is grabbed while f is called
+ */
+void
+skynet_handle_foreach(void (*f)(struct skynet_context *ctx, void *ud), void *ud) {
+	struct handle_storage *s = H;
+	int i;
+	for (i=0;i<s->slot->size;i++) {
+		rwlock_rlock(&s->lock);
+		struct skynet_context * ctx = s->slot->ctx[i];
+		if (ctx)
+			skynet_context_grab(ctx);
+		rwlock_runlock(&s->lock);
+		if (ctx) {
+			f(ctx, ud);
+			skynet_context_release(ctx);
+		}
+	}
+}
+
 /**
   * @brief get the handle of module by handle
   * @param[in] handle id of module
-  * @note
+  * @note the slots are read without lock, see reader_synchronize
   */
 struct skynet_context * 
 skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;
 	struct skynet_context * result = NULL;
 
-	rwlock_rlock(&s->lock);
+	int locked = reader_enter(s);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 	if (ctx && skynet_context_handle(ctx) == handle) {
 		result = ctx;
 		/*add ref of module */
 		skynet_context_grab(result);
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(s, locked);
 	return result;
 }
 
+static uint32_t
+name_hash(const char * name) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	const unsigned char *p = (const unsigned char *)name;
+	while (*p) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct handle_name_table *
+name_table_new(int size) {
+	struct handle_name_table * t = skynet_malloc(sizeof(*t) + (size - 1) * sizeof(struct handle_name *));
+	t->size = size;
+	memset(t->bucket, 0, size * sizeof(struct handle_name *));
+	return t;
+}
+
 /**
- * @brief get module handle by binary search, name as a key
+ * @brief get module handle by hash index, name as a key
  * @param[in] name name of the module
- * 
+ * @note the index is read without lock, see reader_synchronize
  */
 uint32_t 
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
-
-	rwlock_rlock(&s->lock);
-
+	uint32_t h = name_hash(name);
 	uint32_t handle = 0;
 
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	int locked = reader_enter(s);
+
+	struct handle_name_table *t = s->name;
+	struct handle_name *n = t->bucket[h & (t->size - 1)];
+	while (n) {
+		if (n->hash == h && strcmp(n->name, name) == 0) {
 			handle = n->handle;
 			break;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+		n = n->next;
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(s, locked);
 
 	return handle;
 }
 
 /**
- * @brief insert one name before another module
- * @param[in] s storage of the module
- * @param[in] name new module's name
- * @param[in] handle index of the module
- * @param[in] before the other module's index in name storage
+ * @brief version of the name index, a handle resolved by name is valid while it's not changed
+ */
+uint32_t
+skynet_handle_nameversion(void) {
+	return *(volatile uint32_t *)&H->name_version;
+}
+
+/**
+ * @brief double the buckets of name index
+ * @note the readers may walk the old chains, so rebuild the nodes and free the old ones after synchronize
  */
 static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
+_expand_name(struct handle_storage *s) {
+	struct handle_name_table *old = s->name;
+	struct handle_name_table *t = name_table_new(old->size * 2);
+	assert(t->size <= MAX_SLOT_SIZE);
+	int i;
+	for (i=0;i<old->size;i++) {
+		struct handle_name *n;
+		for (n = old->bucket[i]; n; n = n->next) {
+			struct handle_name *nn = skynet_malloc(sizeof(*nn));
+			*nn = *n;
+			struct handle_name **b = &t->bucket[n->hash & (t->size - 1)];
+			nn->next = *b;
+			*b = nn;
 		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
+	}
+	__sync_synchronize();
+	s->name = t;
+	reader_synchronize();
+	for (i=0;i<old->size;i++) {
+		struct handle_name *n = old->bucket[i];
+		while (n) {
+			struct handle_name *next = n->next;
+			skynet_free(n);
+			n = next;
 		}
 	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
+	skynet_free(old);
 }
 
 /**
@@ -249,29 +422,33 @@ _insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int b
  * @param[in] s storage for module
  * @param[in] name new module's name
  * @paran[in] handle new module's id
+ * @return the interned name, NULL if the name exists
  */
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	uint32_t h = name_hash(name);
+	struct handle_name_table *t = s->name;
+	struct handle_name *n;
+	for (n = t->bucket[h & (t->size - 1)]; n; n = n->next) {
+		if (n->hash == h && strcmp(n->name, name) == 0) {
 			return NULL;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
 	}
-	char * result = skynet_strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
+	if (s->name_count >= t->size) {
+		_expand_name(s);
+		t = s->name;
+	}
+	n = skynet_malloc(sizeof(*n));
+	n->name = skynet_strdup(name);
+	n->handle = handle;
+	n->hash = h;
+	struct handle_name **b = &t->bucket[h & (t->size - 1)];
+	n->next = *b;
+	__sync_synchronize();
+	*b = n;
+	s->name_count ++;
 
-	return result;
+	return n->name;
 }
 
 /**
@@ -300,10 +477,7 @@ skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
 	/*slot of socket vec size*/
-	s->slot_size = DEFAULT_SLOT_SIZE;
-
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	s->slot = slot_new(DEFAULT_SLOT_SIZE);
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
@@ -312,9 +486,9 @@ skynet_handle_init(int harbor) {
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	
 	s->handle_index = 1;   
-	s->name_cap = 2;    
 	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	s->name = name_table_new(DEFAULT_NAME_SIZE);
+	s->name_version = 0;
 
 	H = s;
 
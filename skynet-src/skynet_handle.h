@@ -11,8 +11,10 @@ uint32_t skynet_handle_register(struct skynet_context *);
 int skynet_handle_retire(uint32_t handle);
 struct skynet_context * skynet_handle_grab(uint32_t handle);
 void skynet_handle_retireall();
+void skynet_handle_foreach(void (*f)(struct skynet_context *ctx, void *ud), void *ud);
 
 uint32_t skynet_handle_findname(const char * name);
+uint32_t skynet_handle_nameversion(void);
 const char * skynet_handle_namehandle(uint32_t handle, const char *name);
 
 void skynet_handle_init(int harbor);
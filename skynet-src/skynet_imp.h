@@ -9,6 +9,22 @@ struct skynet_config {
 	const char * bootstrap;   
 	const char * logger;        /*logfile path*/
 	const char * logservice;
+	int steal;                  /*worker owns local run queue, and steal from others*/
+	int socket_cpu;             /*cpu to pin socket thread, -1 for none*/
+	int timer_cpu;              /*cpu to pin timer thread, -1 for none*/
+	const char * worker_cpu;    /*cpu list to pin worker threads, like "2-7,10"*/
+	int numa;                   /*services can bind to numa node*/
+	const char * weight;        /*weight of worker threads, like "-1,-1,0,0,1,1"*/
+	int timeslice;              /*time budget (ns) of one dispatch slice, 0 for weight only*/
+	int timer_resolution;       /*timer ticks per second, 100 or 1000*/
+	int socket_thread;          /*tot socket threads, each owns a part of the sockets*/
+	int socket_reuseport;       /*listen in every socket thread with SO_REUSEPORT*/
+	int socket_event;           /*max events of one epoll wait*/
+	int socket_batch;           /*max socket messages collected before push, 1 for push one by one*/
+	int socket_slot;            /*initial sockets of each socket thread*/
+	int socket_max;             /*max sockets of each socket thread*/
+	int socket_accept;          /*max connections accepted for one readiness of the listen socket*/
+	int socket_rawaddr;         /*report the peer address of accepted socket unformatted*/
 };
 
 #define THREAD_WORKER 0             /*thread for module*/
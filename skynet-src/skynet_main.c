@@ -30,7 +30,6 @@ optint(const char *key, int opt) {
 	return strtol(str, NULL, 10);
 }
 
-/*
 static int
 optboolean(const char *key, int opt) {
 	const char * str = skynet_getenv(key);
@@ -40,7 +39,6 @@ optboolean(const char *key, int opt) {
 	}
 	return strcmp(str,"true")==0;
 }
-*/
 
 
 /**
@@ -180,6 +178,22 @@ main(int argc, char *argv[]) {
 	config.daemon = optstring("daemon", NULL);
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
+	config.steal = optboolean("steal", 0);
+	config.socket_cpu = optint("socket_cpu", -1);
+	config.timer_cpu = optint("timer_cpu", -1);
+	config.worker_cpu = optstring("worker_cpu", NULL);
+	config.numa = optboolean("numa", 0);
+	config.weight = optstring("weight", NULL);
+	config.timeslice = optint("timeslice", 0);
+	config.timer_resolution = optint("timer_resolution", 100);
+	config.socket_thread = optint("socket_thread", 1);
+	config.socket_reuseport = optboolean("socket_reuseport", 0);
+	config.socket_event = optint("socket_event", 64);
+	config.socket_batch = optint("socket_batch", 1);
+	config.socket_slot = optint("socket_slot", 4096);
+	config.socket_max = optint("socket_max", 65536);
+	config.socket_accept = optint("socket_accept", 1);
+	config.socket_rawaddr = optboolean("socket_rawaddr", 0);
 
 	lua_close(L);
 
@@ -1,6 +1,7 @@
 #include "skynet.h"
 #include "skynet_mq.h"
 #include "skynet_handle.h"
+#include "skynet_park.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +18,54 @@
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
 
+// high priority queues pushed at the head of a list in a row, then they go to the tail
+// until a queue pushed at the tail is popped, so normal queues are not starved.
+#define MQ_PRIORITY_JUMP 4
+
+#ifdef MQ_LOCKFREE
+
+// Build with -DMQ_LOCKFREE (make linux MYCFLAGS=-DMQ_LOCKFREE) to use the lock-free queue below.
+// It's a multi-producer single-consumer queue : any thread can push, but only the worker
+// which owns the queue (in_global is set and the queue is not in global mq) can pop it.
+
+#define MQ_SEGMENT_SIZE DEFAULT_QUEUE_SIZE
+
+/**
+ * @brief fixed size block of the lock-free queue
+ * @note segments are linked as a list when the queue grows, and recycled (never freed)
+ *	until the queue release, because a producer may still read a stale tail segment.
+ */
+struct mq_segment {
+	struct mq_segment *next;                        /*next segment in queue, or in spare list*/
+	uint64_t base;                                  /*sequence of the first slot*/
+	int ready[MQ_SEGMENT_SIZE];                     /*the slot is written by producer*/
+	struct skynet_message slot[MQ_SEGMENT_SIZE];
+};
+
+/**
+ * @brief manager of queue for module
+ * @note segmented queue, producers claim a slot by CAS on tail
+ */
+struct message_queue {
+	uint32_t handle;
+	int release;                         /*mark the queue as release*/
+	int in_global;                       /*check if the queue is in global*/
+	int node;                            /*numa node bound, -1 for any*/
+	int priority;                        /*MQ_PRIORITY_LOW, MQ_PRIORITY_NORMAL or MQ_PRIORITY_HIGH*/
+	int jumped;                          /*pushed at the head of the list it's in*/
+	int overload;                        /*overload record*/
+	int overload_threshold;              /*trigger val for overload record*/
+	struct message_queue *next;          /*used to link all queue for module together*/
+	uint64_t head;                       /*sequence of head, only changed by consumer*/
+	struct mq_segment *head_seg;         /*segment of head*/
+	struct mq_segment *spare;            /*segments recycled by consumer*/
+	char pad[64];                        /*keep producer side in another cache line*/
+	uint64_t tail;                       /*sequence of tail, claimed by producers*/
+	struct mq_segment *tail_seg;         /*segment of tail*/
+};
+
+#else
+
 /**
  * @brief manager of queue for module
  * @note circular Queue
@@ -29,12 +78,17 @@ struct message_queue {
 	int lock;                            /*mutex lock*/
 	int release;                         /*mark the queue as release*/
 	int in_global;                       /*check if the queue is in global*/
+	int node;                            /*numa node bound, -1 for any*/
+	int priority;                        /*MQ_PRIORITY_LOW, MQ_PRIORITY_NORMAL or MQ_PRIORITY_HIGH*/
+	int jumped;                          /*pushed at the head of the list it's in*/
 	int overload;                        /*overload record*/
 	int overload_threshold;              /*trigger val for overload record*/ 
 	struct skynet_message *queue;        /*pointer to the array*/
 	struct message_queue *next;          /*used to link all queue for module together*/
 };
 
+#endif
+
 /**
   * @brief global queue
   * @note all queue for module store in it as a list
@@ -44,24 +98,57 @@ struct global_queue {
 	struct message_queue *head;       /*index for head */
 	struct message_queue *tail;       /*index for tail*/
 	int lock;                         /*mutex lock*/
+	int jump;                         /*queues pushed at head since a queue from tail popped*/
 };
 
 static struct global_queue *Q = NULL;     /*one local example for global queue*/
 
+#define LOCAL_QUEUE_SIZE 256
+#define GLOBAL_CHECK_INTERVAL 61
+
+/**
+  * @brief run queue owned by one worker thread (enabled by config steal = true)
+  * @note the owner pushes and pops it, other workers steal from it when they are idle.
+  *	The global list is used when it's full, or the queue is pushed by other threads (socket, timer).
+  */
+struct local_queue {
+	int lock;                                        /*mutex lock*/
+	unsigned head;                                   /*index of head*/
+	unsigned tail;                                   /*index of tail*/
+	unsigned tick;                                   /*pop counter, check global list sometimes for fairness*/
+	int jump;                                        /*queues pushed at head since a queue from tail popped*/
+	struct message_queue *queue[LOCAL_QUEUE_SIZE];
+	char pad[64];                                    /*avoid false sharing with the next one*/
+};
+
+static struct local_queue **LQ = NULL;    /*local queues of all workers*/
+static int LQ_count = 0;                  /*num of workers*/
+static __thread int LQ_id = -1;           /*worker id of current thread, -1 for not worker*/
+
+static struct global_queue *NQ = NULL;    /*global list of each numa node, for the queues bound to node*/
+static int NQ_count = 0;                  /*num of numa nodes*/
+static int *WN = NULL;                    /*numa node of each worker*/
+static int *NW = NULL;                    /*num of workers on each numa node*/
+
 #define LOCK(q) while (__sync_lock_test_and_set(&(q)->lock,1)) {}      /*get the mutex lock*/
 #define UNLOCK(q) __sync_lock_release(&(q)->lock);                     /*release the mutex lock*/       
 
 /**
- * @brief push one module queue into the global queue
+ * @brief push one module queue into the global list
  * @param[in|out] queue pointer to the module queue
- *
+ * @note high priority queue is pushed at head, MQ_PRIORITY_JUMP times at most before a queue from tail pops
  */
-void 
-skynet_globalmq_push(struct message_queue * queue) {
-	struct global_queue *q= Q;
+static void 
+_global_push(struct global_queue *q, struct message_queue * queue) {
 	LOCK(q)
 	assert(queue->next == NULL);
-	if(q->tail) {
+	queue->jumped = 0;
+	if (queue->priority > MQ_PRIORITY_NORMAL && q->head && q->jump < MQ_PRIORITY_JUMP) {
+		++q->jump;
+		queue->jumped = 1;
+		queue->next = q->head;
+		q->head = queue;
+	} else if(q->tail) {
 		q->tail->next = queue;
 		q->tail = queue;
 	} else {
@@ -71,13 +158,16 @@ skynet_globalmq_push(struct message_queue * queue) {
 }
 
 /**
- * @brief pop one module queue from the global queue
+ * @brief pop one module queue from the global list
  * @param[in|out] queue pointer for the module queue
  *
  */
-struct message_queue * 
-skynet_globalmq_pop() {
-	struct global_queue *q = Q;
+static struct message_queue * 
+_global_pop(struct global_queue *q) {
+	if (q->head == NULL) {
+		// empty, don't touch the lock (idle workers spin here)
+		return NULL;
+	}
 
 	LOCK(q)
 	struct message_queue *mq = q->head;
@@ -88,11 +178,465 @@ skynet_globalmq_pop() {
 			q->tail = NULL;
 		}
 		mq->next = NULL;
+		if (!mq->jumped) {
+			q->jump = 0;
+		}
 	}
 	UNLOCK(q)
 	return mq;
 }
 
+/**
+ * @brief push into the local queue of worker
+ * @return 0 for success, 1 when the local queue is full
+ * @note high priority queue is pushed at head like _global_push
+ */
+static int
+_local_push(struct local_queue *lq, struct message_queue *queue) {
+	int ret = 1;
+	LOCK(lq)
+	if (lq->tail - lq->head < LOCAL_QUEUE_SIZE) {
+		queue->jumped = 0;
+		if (queue->priority > MQ_PRIORITY_NORMAL && lq->head != lq->tail && lq->jump < MQ_PRIORITY_JUMP) {
+			++lq->jump;
+			queue->jumped = 1;
+			lq->queue[--lq->head % LOCAL_QUEUE_SIZE] = queue;
+		} else {
+			lq->queue[lq->tail++ % LOCAL_QUEUE_SIZE] = queue;
+		}
+		ret = 0;
+	}
+	UNLOCK(lq)
+	return ret;
+}
+
+/**
+ * @brief pop from the local queue of worker, used by owner and thieves
+ */
+static struct message_queue *
+_local_pop(struct local_queue *lq) {
+	if (lq->head == lq->tail) {
+		// empty, don't touch the lock
+		return NULL;
+	}
+	struct message_queue *mq = NULL;
+	LOCK(lq)
+	if (lq->head != lq->tail) {
+		mq = lq->queue[lq->head++ % LOCAL_QUEUE_SIZE];
+		if (!mq->jumped) {
+			lq->jump = 0;
+		}
+	}
+	UNLOCK(lq)
+	return mq;
+}
+
+/**
+ * @brief push one module queue into the global queue
+ * @param[in|out] queue pointer to the module queue
+ * @note push into the local queue of current worker if steal is enabled
+ */
+void 
+skynet_globalmq_push(struct message_queue * queue) {
+	int id = LQ_id;
+	int node = queue->node;
+	if (node >= 0) {
+		// bound to numa node, only the workers on the node can run it
+		if (id < 0 || WN[id] != node || LQ == NULL || _local_push(LQ[id], queue)) {
+			_global_push(&NQ[node], queue);
+		}
+	} else if (id < 0 || LQ == NULL || _local_push(LQ[id], queue)) {
+		_global_push(Q, queue);
+	}
+	// wakeup a parked worker (if any) to run it
+	skynet_park_wakeup(node);
+}
+
+/**
+ * @brief pop one module queue from the global queue
+ * @note worker pops the list of its numa node and its local queue first, then the global list,
+ *	and steals from other workers (on the same node if numa enabled) at last
+ *
+ */
+struct message_queue * 
+skynet_globalmq_pop() {
+	int id = LQ_id;
+	struct message_queue *mq;
+	if (id >= 0 && NQ) {
+		mq = _global_pop(&NQ[WN[id]]);
+		if (mq) {
+			return mq;
+		}
+	}
+	if (id < 0 || LQ == NULL) {
+		return _global_pop(Q);
+	}
+	struct local_queue *lq = LQ[id];
+	if (++lq->tick % GLOBAL_CHECK_INTERVAL == 0) {
+		mq = _global_pop(Q);
+		if (mq) {
+			return mq;
+		}
+	}
+	mq = _local_pop(lq);
+	if (mq) {
+		return mq;
+	}
+	mq = _global_pop(Q);
+	if (mq) {
+		return mq;
+	}
+	int i;
+	for (i=1;i<LQ_count;i++) {
+		int victim = (id + i) % LQ_count;
+		if (NQ && WN[victim] != WN[id]) {
+			continue;
+		}
+		mq = _local_pop(LQ[victim]);
+		if (mq) {
+			return mq;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief enable local queues for workers
+ * @param[in] worker num of worker threads
+ * @note call it before the worker threads start
+ */
+void
+skynet_globalmq_local_init(int worker) {
+	struct local_queue ** lq = skynet_malloc(worker * sizeof(*lq));
+	int i;
+	for (i=0;i<worker;i++) {
+		lq[i] = skynet_malloc(sizeof(struct local_queue));
+		memset(lq[i], 0, sizeof(struct local_queue));
+	}
+	LQ_count = worker;
+	LQ = lq;
+}
+
+/**
+ * @brief enable numa node lists
+ * @param[in] worker num of worker threads
+ * @param[in] node numa node of each worker
+ * @note call it before the worker threads start
+ */
+void
+skynet_globalmq_numa_init(int worker, const int *node) {
+	int i;
+	int n = 0;
+	WN = skynet_malloc(worker * sizeof(int));
+	for (i=0;i<worker;i++) {
+		WN[i] = node[i];
+		if (node[i] >= n) {
+			n = node[i] + 1;
+		}
+	}
+	NW = skynet_malloc(n * sizeof(int));
+	memset(NW, 0, n * sizeof(int));
+	for (i=0;i<worker;i++) {
+		NW[node[i]]++;
+	}
+	struct global_queue *nq = skynet_malloc(n * sizeof(*nq));
+	memset(nq, 0, n * sizeof(*nq));
+	NQ_count = n;
+	NQ = nq;
+}
+
+/**
+ * @brief bind current thread to the local queue of worker
+ * @param[in] id worker id
+ */
+void
+skynet_globalmq_local_bind(int id) {
+	LQ_id = id;
+}
+
+static void _release(struct message_queue *q);
+
+/**
+  * @brief drop message in the queue
+  * @param[in] q handle of the queue
+  * @param[in] drop_func function used to drop the message
+  * @param[in] ud  module index for the queue
+  */
+static void
+_drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
+	struct skynet_message msg;
+	/*drop all message*/
+	while(!skynet_mq_pop(q, &msg)) {
+		drop_func(&msg, ud);
+	}
+	/*release queue*/
+	_release(q);
+}
+
+#ifdef MQ_LOCKFREE
+
+/**
+ * @brief get a segment from the spare list, or alloc a new one
+ * @param[in] q handle of the queue
+ * @note only one producer (who claims the last slot of tail segment) can call it at the same time
+ */
+static struct mq_segment *
+segment_get(struct message_queue *q) {
+	for (;;) {
+		struct mq_segment *seg = q->spare;
+		if (seg == NULL) {
+			seg = skynet_malloc(sizeof(*seg));
+			memset(seg->ready, 0, sizeof(seg->ready));
+			return seg;
+		}
+		if (__sync_bool_compare_and_swap(&q->spare, seg, seg->next)) {
+			return seg;
+		}
+	}
+}
+
+/**
+ * @brief put a consumed segment back to the spare list
+ * @param[in] q handle of the queue
+ * @param[in] seg segment all slots popped
+ * @note called by consumer only
+ */
+static void
+segment_put(struct message_queue *q, struct mq_segment *seg) {
+	do {
+		seg->next = q->spare;
+	} while (!__sync_bool_compare_and_swap(&q->spare, seg->next, seg));
+}
+
+/**
+ * @brief init the queue for the module
+ * @param[in] handle index for the module
+ * return success ? module : NUll
+ */
+struct message_queue * 
+skynet_mq_create(uint32_t handle) {
+	struct message_queue *q = skynet_malloc(sizeof(*q));
+	memset(q, 0, sizeof(*q));
+	q->handle = handle;
+	// the same as the locked queue, see below
+	q->in_global = MQ_IN_GLOBAL;
+	q->node = -1;
+	q->priority = MQ_PRIORITY_NORMAL;
+	q->overload_threshold = MQ_OVERLOAD;
+	struct mq_segment *seg = segment_get(q);
+	seg->next = NULL;
+	seg->base = 0;
+	q->head_seg = q->tail_seg = seg;
+
+	return q;
+}
+
+/**
+  * @brief just release the queue
+  * @param[in|out] q handle of the queue
+  * @note ignore the message in the queue
+  */
+static void 
+_release(struct message_queue *q) {
+	assert(q->next == NULL);
+	struct mq_segment *seg = q->head_seg;
+	while (seg) {
+		struct mq_segment *next = seg->next;
+		skynet_free(seg);
+		seg = next;
+	}
+	seg = q->spare;
+	while (seg) {
+		struct mq_segment *next = seg->next;
+		skynet_free(seg);
+		seg = next;
+	}
+	skynet_free(q);
+}
+
+/**
+  * @brief get the nums of messages store in the module queue
+  * @param[in|out] q handle of thq queue
+  * @return nums of message (include the slots claimed but not written yet)
+  */
+int
+skynet_mq_length(struct message_queue *q) {
+	uint64_t head = q->head;
+	uint64_t tail = q->tail;
+	if (tail <= head) {
+		return 0;
+	}
+	return (int)(tail - head);
+}
+
+/**
+  * @brief peek the message at head
+  * @param[in] q hande of the message queue
+  * @param[out] ready slot flag of the message
+  * @return NULL when the queue is empty (or the producer hasn't finish writing)
+  */
+static struct skynet_message *
+_peek(struct message_queue *q, int **ready) {
+	struct mq_segment *seg = q->head_seg;
+	int off = (int)(q->head - seg->base);
+	if (off == MQ_SEGMENT_SIZE) {
+		struct mq_segment *next = seg->next;
+		if (next == NULL) {
+			return NULL;
+		}
+		__sync_synchronize();
+		q->head_seg = next;
+		segment_put(q, seg);
+		seg = next;
+		off = 0;
+	}
+	if (seg->ready[off] == 0) {
+		return NULL;
+	}
+	__sync_synchronize();
+	*ready = &seg->ready[off];
+	return &seg->slot[off];
+}
+
+/**
+  * @brief try to pop one message from the module queue
+  * @param[out|out] q hande of the message queue
+  * @param[out] message used to get the message 
+  * @note the queue is removed from global queue (in_global = 0) when it's empty,
+  *	and producers recheck in_global after the message written.
+  */
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	for (;;) {
+		int *ready = NULL;
+		struct skynet_message *m = _peek(q, &ready);
+		if (m) {
+			*message = *m;
+			*ready = 0;
+			++q->head;
+			int length = skynet_mq_length(q);
+			while (length > q->overload_threshold) {
+				q->overload = length;
+				q->overload_threshold *= 2;
+			}
+			return 0;
+		}
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+		__sync_synchronize();
+		if (_peek(q, &ready) == NULL) {
+			return 1;
+		}
+		// A message arrived before in_global cleared, take back the queue.
+		// If failed, the producer has already pushed the queue into global queue.
+		if (!__sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			return 1;
+		}
+	}
+}
+
+/**
+  * @brief claim a slot and publish one message, the queue is not pushed into global queue
+  */
+static void
+_push_slot(struct message_queue *q, struct skynet_message *message) {
+	struct mq_segment *seg;
+	uint64_t pos;
+	int off;
+	for (;;) {
+		seg = q->tail_seg;
+		__sync_synchronize();
+		pos = q->tail;
+		uint64_t diff = pos - seg->base;
+		// diff is out of range when the tail segment is installing by other producer, or seg is stale
+		if (diff < MQ_SEGMENT_SIZE && __sync_bool_compare_and_swap(&q->tail, pos, pos + 1)) {
+			off = (int)diff;
+			break;
+		}
+	}
+	if (off == MQ_SEGMENT_SIZE - 1) {
+		// claim the last slot, so install the next segment
+		struct mq_segment *ns = segment_get(q);
+		ns->next = NULL;
+		ns->base = pos + 1;
+		__sync_synchronize();
+		seg->next = ns;
+		q->tail_seg = ns;
+	}
+	seg->slot[off] = *message;
+	__sync_synchronize();
+	seg->ready[off] = 1;
+}
+
+/**
+  * @brief push one message into the module queue
+  * @param[in|out] q queue for the module
+  * @param[in] message message wait to push into the module queue
+  *
+  */
+void 
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	assert(message);
+	_push_slot(q, message);
+	__sync_synchronize();
+	/*try to push the module_queue into global queue after push new message into it*/
+	if (q->in_global == 0 && __sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
+}
+
+/**
+  * @brief push n messages into the module queue, and push the queue into global queue once
+  */
+void
+skynet_mq_push_batch(struct message_queue *q, struct skynet_message *message, int n) {
+	assert(message && n > 0);
+	int i;
+	for (i=0;i<n;i++) {
+		_push_slot(q, &message[i]);
+	}
+	__sync_synchronize();
+	if (q->in_global == 0 && __sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
+}
+
+/**
+  * @brief mark the queue as wait to release
+  * @param[in] q handle of the queue
+  * 
+  */
+void 
+skynet_mq_mark_release(struct message_queue *q) {
+	assert(q->release == 0);
+	q->release = 1;
+	__sync_synchronize();
+	if (__sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
+}
+
+/**
+  * @brief try to release the queue
+  * @param[in] q handle of the module queue (owned by caller)
+  * @param[in] drop_func function used to drop the messsage
+  * @param[in] ud module id for the queue
+  *
+  */
+void 
+skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
+	__sync_synchronize();
+	if (q->release) {
+		_drop_queue(q, drop_func, ud);
+	} else {
+		// skynet_mq_mark_release will fail to push it because in_global is set
+		skynet_globalmq_push(q);
+	}
+}
+
+#else
+
 /**
  * @brief init the queue for the module
  * @param[in] handle index for the module
@@ -110,6 +654,8 @@ skynet_mq_create(uint32_t handle) {
 	// set in_global flag to avoid push it to global queue .
 	// If the service init success, skynet_context_new will call skynet_mq_force_push to push it to global queue.
 	q->in_global = MQ_IN_GLOBAL;                        /*all queue push into global queue at first*/
+	q->node = -1;                                       /*run on any worker*/
+	q->priority = MQ_PRIORITY_NORMAL;
 	q->release = 0;			                    /*mark the queue as wait to release*/
 	q->overload = 0;					
 	q->overload_threshold = MQ_OVERLOAD;                
@@ -131,15 +677,6 @@ _release(struct message_queue *q) {
 	skynet_free(q);					
 }
 
-/**
- * @brief get the index of module the queue belong to
- * @return module index
- */
-uint32_t 
-skynet_mq_handle(struct message_queue *q) {
-	return q->handle;
-}
-
 /**
   * @brief get the nums of messages store in the module queue
   * @param[in|out] q handle of thq queue
@@ -161,22 +698,6 @@ skynet_mq_length(struct message_queue *q) {
 	return tail + cap - head;
 }
 
-/**
-  * @brief try to get the overloead of the queue and reset the overload
-  * @param[in] q handle of the queue
-  * @return overload record
-  *
-  */
-int
-skynet_mq_overload(struct message_queue *q) {
-	if (q->overload) {
-		int overload = q->overload;
-		q->overload = 0;
-		return overload;
-	} 
-	return 0;
-}
-
 /**
   * @brief try to pop one message from the module queue
   * @param[out|out] q hande of the message queue
@@ -271,22 +792,48 @@ skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
 		expand_queue(q);
 	}
 	/*try to push the module_queue into global queue after push new message into it*/
+	int activate = 0;
 	if (q->in_global == 0) {
 		q->in_global = MQ_IN_GLOBAL;
-		skynet_globalmq_push(q);
+		activate = 1;
 	}
 	UNLOCK(q)
+	// push it out of the lock, the worker woken may preempt us and spin on the lock
+	if (activate) {
+		skynet_globalmq_push(q);
+	}
 }
 
 /**
- * @brief alloc the global queue
- *
- */
-void 
-skynet_mq_init() {
-	struct global_queue *q = skynet_malloc(sizeof(*q));
-	memset(q,0,sizeof(*q));
-	Q=q;
+  * @brief push n messages into the module queue with one lock
+  * @param[in|out] q queue for the module
+  * @param[in] message array of messages
+  * @param[in] n size of the array
+  *
+  */
+void
+skynet_mq_push_batch(struct message_queue *q, struct skynet_message *message, int n) {
+	assert(message && n > 0);
+	int i;
+	LOCK(q)
+	for (i=0;i<n;i++) {
+		q->queue[q->tail] = message[i];
+		if (++ q->tail >= q->cap) {
+			q->tail = 0;
+		}
+		if (q->head == q->tail) {
+			expand_queue(q);
+		}
+	}
+	int activate = 0;
+	if (q->in_global == 0) {
+		q->in_global = MQ_IN_GLOBAL;
+		activate = 1;
+	}
+	UNLOCK(q)
+	if (activate) {
+		skynet_globalmq_push(q);
+	}
 }
 
 /**
@@ -301,27 +848,16 @@ skynet_mq_mark_release(struct message_queue *q) {
 	/*mark release flag*/
 	q->release = 1;
 	/*push the module queue into the global queue, so can delete the queue when module queue active*/
+	int activate = 0;
 	if (q->in_global != MQ_IN_GLOBAL) {
-		skynet_globalmq_push(q);
+		q->in_global = MQ_IN_GLOBAL;
+		activate = 1;
 	}
 	UNLOCK(q)
-}
-
-/**
-  * @brief drop message in the queue
-  * @param[in] q handle of the queue
-  * @param[in] drop_func function used to drop the message
-  * @param[in] ud  module index for the queue
-  */
-static void
-_drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
-	struct skynet_message msg;
-	/*drop all message*/
-	while(!skynet_mq_pop(q, &msg)) {
-		drop_func(&msg, ud);
+	// push it out of the lock, see skynet_mq_push
+	if (activate) {
+		skynet_globalmq_push(q);
 	}
-	/*release queue*/
-	_release(q);
 }
 
 /**
@@ -340,8 +876,77 @@ skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
 		/*destory the queue*/
 		_drop_queue(q, drop_func, ud);
 	} else {
+		UNLOCK(q)
 	        /*push it into global queue again*/
 		skynet_globalmq_push(q);
-		UNLOCK(q)
 	}
 }
+
+#endif
+
+/**
+ * @brief get the index of module the queue belong to
+ * @return module index
+ */
+uint32_t 
+skynet_mq_handle(struct message_queue *q) {
+	return q->handle;
+}
+
+/**
+  * @brief try to get the overloead of the queue and reset the overload
+  * @param[in] q handle of the queue
+  * @return overload record
+  *
+  */
+int
+skynet_mq_overload(struct message_queue *q) {
+	if (q->overload) {
+		int overload = q->overload;
+		q->overload = 0;
+		return overload;
+	} 
+	return 0;
+}
+
+/**
+ * @brief bind the queue to a numa node, the queue should be owned by caller (dispatching)
+ * @param[in] q handle of the queue
+ * @param[in] node numa node, -1 for any
+ * @return 0 for success, 1 for numa disabled or invalid node
+ * @note a node without workers is invalid, no one would run the queue
+ */
+int
+skynet_mq_setnode(struct message_queue *q, int node) {
+	if (node >= NQ_count || node < -1 || (node >= 0 && NW[node] == 0)) {
+		return 1;
+	}
+	q->node = node;
+	return 0;
+}
+
+/**
+ * @brief set the priority class of the queue, the queue should be owned by caller (dispatching)
+ * @param[in] q handle of the queue
+ * @param[in] priority MQ_PRIORITY_LOW, MQ_PRIORITY_NORMAL or MQ_PRIORITY_HIGH
+ */
+void
+skynet_mq_setpriority(struct message_queue *q, int priority) {
+	q->priority = priority;
+}
+
+int
+skynet_mq_priority(struct message_queue *q) {
+	return q->priority;
+}
+
+/**
+ * @brief alloc the global queue
+ *
+ */
+void 
+skynet_mq_init() {
+	struct global_queue *q = skynet_malloc(sizeof(*q));
+	memset(q,0,sizeof(*q));
+	Q=q;
+}
@@ -18,8 +18,15 @@ struct skynet_message {
 
 struct message_queue;
 
+#define MQ_PRIORITY_LOW (-1)
+#define MQ_PRIORITY_NORMAL 0
+#define MQ_PRIORITY_HIGH 1
+
 void skynet_globalmq_push(struct message_queue * queue);
 struct message_queue * skynet_globalmq_pop(void);
+void skynet_globalmq_local_init(int worker);
+void skynet_globalmq_local_bind(int id);
+void skynet_globalmq_numa_init(int worker, const int *node);
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -28,10 +35,14 @@ typedef void (*message_drop)(struct skynet_message *, void *);
 
 void skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud);
 uint32_t skynet_mq_handle(struct message_queue *);
+int skynet_mq_setnode(struct message_queue *q, int node);
+void skynet_mq_setpriority(struct message_queue *q, int priority);
+int skynet_mq_priority(struct message_queue *q);
 
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+void skynet_mq_push_batch(struct message_queue *q, struct skynet_message *message, int n);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
@@ -0,0 +1,247 @@
+#include "skynet.h"
+
+#include "skynet_park.h"
+#include "skynet_mq.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PARK_RUNNING 0
+#define PARK_WAITING 1
+#define PARK_NOTIFIED 2
+
+#define SPIN_MIN 4
+#define SPIN_MAX 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define CPU_RELAX() __sync_synchronize()
+#endif
+
+/**
+ * @brief wait slot of one worker thread
+ * @note a pusher changes state from WAITING to NOTIFIED, then signal the cond of this slot only
+ */
+struct park_slot {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int state;              /*PARK_RUNNING, PARK_WAITING or PARK_NOTIFIED*/
+	int spin;               /*adaptive spin limit before park*/
+	int node;               /*numa node of the worker*/
+	uint32_t park;          /*times of parked*/
+	uint32_t spurious;      /*wakeups found no work*/
+	uint32_t spin_hit;      /*times of spinning found work*/
+	char pad[64];           /*avoid false sharing with the next slot*/
+};
+
+/**
+ * @brief parking manager of all workers
+ */
+struct park {
+	int count;              /*num of workers*/
+	int sleep;              /*num of workers parked (or going to park)*/
+	int quit;               /*set when skynet exit*/
+	unsigned next;          /*first slot to check when wakeup*/
+	uint32_t wakeup;        /*targeted wakeups*/
+	struct park_slot *slot;
+};
+
+static struct park *P = NULL;
+
+/**
+ * @brief init wait slots for workers
+ * @param[in] worker num of worker threads
+ */
+void
+skynet_park_init(int worker) {
+	struct park *p = skynet_malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	p->count = worker;
+	p->slot = skynet_malloc(worker * sizeof(struct park_slot));
+	memset(p->slot, 0, worker * sizeof(struct park_slot));
+	int i;
+	for (i=0;i<worker;i++) {
+		struct park_slot *s = &p->slot[i];
+		if (pthread_mutex_init(&s->mutex, NULL)) {
+			fprintf(stderr, "Init mutex error");
+			exit(1);
+		}
+		if (pthread_cond_init(&s->cond, NULL)) {
+			fprintf(stderr, "Init cond error");
+			exit(1);
+		}
+		s->state = PARK_RUNNING;
+		s->spin = SPIN_MIN;
+	}
+	P = p;
+}
+
+/**
+ * @brief release wait slots, after all workers exit
+ */
+void
+skynet_park_free(void) {
+	struct park *p = P;
+	int i;
+	for (i=0;i<p->count;i++) {
+		pthread_mutex_destroy(&p->slot[i].mutex);
+		pthread_cond_destroy(&p->slot[i].cond);
+	}
+	P = NULL;
+	skynet_free(p->slot);
+	skynet_free(p);
+}
+
+/**
+ * @brief leave the parking state without sleeping
+ */
+static void
+_cancel(struct park *p, struct park_slot *s) {
+	if (!__sync_bool_compare_and_swap(&s->state, PARK_WAITING, PARK_RUNNING)) {
+		// notified by a pusher already, the wakeup is consumed by us.
+		s->state = PARK_RUNNING;
+	}
+	__sync_sub_and_fetch(&p->sleep, 1);
+}
+
+/**
+ * @brief spin for a while, then park the worker until a queue is pushed
+ * @param[in] id worker id
+ * @return message queue found, or NULL when skynet exit
+ * @note the spin limit grows when spinning finds work, and shrinks when the worker parks
+ */
+struct message_queue *
+skynet_park(int id) {
+	struct park *p = P;
+	struct park_slot *s = &p->slot[id];
+	struct message_queue *q;
+	for (;;) {
+		int i;
+		for (i=0;i<s->spin;i++) {
+			q = skynet_globalmq_pop();
+			if (q) {
+				++s->spin_hit;
+				if (s->spin < SPIN_MAX) {
+					s->spin *= 2;
+				}
+				return q;
+			}
+			CPU_RELAX();
+		}
+		if (s->spin > SPIN_MIN) {
+			s->spin /= 2;
+		}
+
+		s->state = PARK_WAITING;
+		__sync_add_and_fetch(&p->sleep, 1);
+		// recheck after sleep count increased, skynet_park_wakeup reads it after the queue pushed.
+		q = skynet_globalmq_pop();
+		if (q || p->quit) {
+			_cancel(p, s);
+			return q;
+		}
+
+		pthread_mutex_lock(&s->mutex);
+		++s->park;
+		while (s->state == PARK_WAITING && !p->quit) {
+			pthread_cond_wait(&s->cond, &s->mutex);
+		}
+		s->state = PARK_RUNNING;
+		pthread_mutex_unlock(&s->mutex);
+		__sync_sub_and_fetch(&p->sleep, 1);
+
+		if (p->quit) {
+			return NULL;
+		}
+		q = skynet_globalmq_pop();
+		if (q) {
+			return q;
+		}
+		// others took the work first
+		++s->spurious;
+	}
+}
+
+/**
+ * @brief set numa node of the worker, before the worker threads start
+ * @param[in] id worker id
+ * @param[in] node numa node
+ */
+void
+skynet_park_setnode(int id, int node) {
+	P->slot[id].node = node;
+}
+
+/**
+ * @brief wakeup one parked worker, call it after a queue pushed into global queue
+ * @param[in] node numa node of the queue, -1 for any
+ */
+void
+skynet_park_wakeup(int node) {
+	struct park *p = P;
+	if (p == NULL) {
+		return;
+	}
+	__sync_synchronize();
+	if (p->sleep == 0) {
+		return;
+	}
+	int n = p->count;
+	unsigned start = p->next;
+	int i;
+	for (i=0;i<n;i++) {
+		int id = (start + i) % n;
+		struct park_slot *s = &p->slot[id];
+		if (node >= 0 && s->node != node) {
+			continue;
+		}
+		if (s->state == PARK_WAITING && __sync_bool_compare_and_swap(&s->state, PARK_WAITING, PARK_NOTIFIED)) {
+			p->next = id + 1;
+			__sync_fetch_and_add(&p->wakeup, 1);
+			pthread_mutex_lock(&s->mutex);
+			pthread_cond_signal(&s->cond);
+			pthread_mutex_unlock(&s->mutex);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief wakeup all workers, when skynet exit
+ */
+void
+skynet_park_wakeall(void) {
+	struct park *p = P;
+	p->quit = 1;
+	__sync_synchronize();
+	int i;
+	for (i=0;i<p->count;i++) {
+		struct park_slot *s = &p->slot[i];
+		pthread_mutex_lock(&s->mutex);
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+
+/**
+ * @brief sum the counters of all slots
+ * @param[out] stat counters
+ */
+void
+skynet_park_stat(struct skynet_park_stat *stat) {
+	memset(stat, 0, sizeof(*stat));
+	struct park *p = P;
+	if (p == NULL) {
+		return;
+	}
+	stat->wakeup = p->wakeup;
+	int i;
+	for (i=0;i<p->count;i++) {
+		stat->park += p->slot[i].park;
+		stat->spurious += p->slot[i].spurious;
+		stat->spin += p->slot[i].spin_hit;
+	}
+}
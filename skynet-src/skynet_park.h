@@ -0,0 +1,26 @@
+#ifndef SKYNET_PARK_H
+#define SKYNET_PARK_H
+
+#include <stdint.h>
+
+struct message_queue;
+
+/**
+ * @brief counters of worker parking, read by STAT command
+ */
+struct skynet_park_stat {
+	uint32_t park;          /*times of worker parked*/
+	uint32_t wakeup;        /*targeted wakeups sent by pushers*/
+	uint32_t spurious;      /*wakeups found no work*/
+	uint32_t spin;          /*times of spinning found work*/
+};
+
+void skynet_park_init(int worker);
+void skynet_park_free(void);
+struct message_queue * skynet_park(int id);	// return a queue found, or NULL after wakeup
+void skynet_park_setnode(int id, int node);
+void skynet_park_wakeup(int node);	// node -1 for any worker
+void skynet_park_wakeall(void);
+void skynet_park_stat(struct skynet_park_stat *stat);
+
+#endif
@@ -10,6 +10,10 @@
 #include "skynet_monitor.h"
 #include "skynet_imp.h"
 #include "skynet_log.h"
+#include "skynet_park.h"
+#include "skynet_socket.h"
+#include "socket_buffer.h"
+#include "malloc_hook.h"
 
 #include <pthread.h>
 
@@ -18,6 +22,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
 
 #ifdef CALLING_CHECK
 
@@ -35,6 +40,18 @@
 
 #endif
 
+#define NAME_CACHE_SIZE 8           /*names resolved by skynet_sendname cached in context*/
+#define NAME_CACHE_LENGTH 32
+
+/**
+ * @brief a name resolved, valid while the version of name index is not changed
+ */
+struct name_cache {
+	uint32_t version;
+	uint32_t handle;                /*0 for empty*/
+	char name[NAME_CACHE_LENGTH];
+};
+
 /**
  *  @brief manager for module
  *
@@ -52,6 +69,8 @@ struct skynet_context {
 	int ref;                        /*ref for this module*/
 	bool init;                      /*flag if the handle init finished*/
 	bool endless;
+	struct name_cache name_cache[NAME_CACHE_SIZE];
+	struct malloc_stat *memory;     /*C memory of this module, may live longer than the context, see malloc_hook.c*/
 
 	CHECKCALLING_DECL
 };
@@ -60,10 +79,11 @@ struct skynet_node {
 	int total;                          
 	int init;
 	uint32_t monitor_exit;
-	pthread_key_t handle_key;       /*shared data in the thread*/   
+	uint64_t timeslice;             /*time budget (ns) of one dispatch slice, 0 for weight only*/
 };
 
 static struct skynet_node G_NODE;
+static __thread uint32_t T_handle = 0; /*module running on this thread, or -THREAD_xxx*/
 
 /**
  * @brief tot 
@@ -97,8 +117,7 @@ context_dec() {
 uint32_t 
 skynet_current_handle(void) {
 	if (G_NODE.init) {
-		void * handle = pthread_getspecific(G_NODE.handle_key);
-		return (uint32_t)(uintptr_t)handle;
+		return T_handle;
 	} else {
 		uintptr_t v = (uint32_t)(-THREAD_MAIN);
 		return v;
@@ -127,6 +146,19 @@ struct drop_t {
 	uint32_t handle;    /*id of the module*/
 };
 
+static skynet_drop_cb DROP_HOOK[256];  /*drop hook of each message type, see skynet_drop_hook*/
+
+/**
+ * @brief set the drop hook of a message type, called by drop_message before the message is freed
+ * @param[in] type message type
+ * @param[in] cb hook, NULL for none
+ */
+void
+skynet_drop_hook(int type, skynet_drop_cb cb) {
+	assert(type >= 0 && type < 256);
+	DROP_HOOK[type] = cb;
+}
+
 /**
  * @brief drop msg
  * @param[in] msg msg wait to drop
@@ -135,7 +167,16 @@ struct drop_t {
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	int type = msg->sz >> HANDLE_REMOTE_SHIFT;
+	if (type == PTYPE_SOCKET) {
+		skynet_socket_message_free(msg->data);
+	} else {
+		skynet_drop_cb hook = DROP_HOOK[type];
+		if (hook) {
+			hook(msg->data, msg->sz & HANDLE_MASK);
+		}
+		skynet_free(msg->data);
+	}
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
@@ -175,6 +216,8 @@ skynet_context_new(const char * name, const char *param) {
 
 	ctx->init = false;
 	ctx->endless = false;
+	memset(ctx->name_cache, 0, sizeof(ctx->name_cache));
+	ctx->memory = malloc_stat_new();
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	
 	ctx->handle = skynet_handle_register(ctx);
@@ -183,8 +226,12 @@ skynet_context_new(const char * name, const char *param) {
 	context_inc();
 
 	CHECKCALLING_BEGIN(ctx)
-	/*init with the inst*/
+	/*init with the inst, the memory alloc by init is counted in the new module*/
+	struct malloc_stat *caller = malloc_current_get();
+	malloc_current(ctx->memory);
 	int r = skynet_module_instance_init(mod, inst, ctx, param);
+	// context_new is called in the dispatch of the caller (the launcher) usually
+	malloc_current(caller);
 	CHECKCALLING_END(ctx)
 	if (r == 0) {
 		struct skynet_context * ret = skynet_context_release(ctx);
@@ -260,6 +307,8 @@ delete_context(struct skynet_context *ctx) {
 	skynet_module_instance_release(ctx->mod, ctx->instance);
 	/*mark the queue of the module as release*/
 	skynet_mq_mark_release(ctx->queue);
+	/*the memory counter is freed after the blocks of the module left are freed*/
+	malloc_stat_release(ctx->memory);
 	/*free handle but the queue left*/
 	skynet_free(ctx);
 	context_dec();
@@ -297,6 +346,24 @@ skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	return 0;
 }
 
+/**
+ * @brief push n messages into the queue of the module, grab the context once
+ * @param[in] handle id of the module
+ * @param[in] message array of messages
+ * @param[in] n size of the array
+ */
+int
+skynet_context_push_batch(uint32_t handle, struct skynet_message *message, int n) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return -1;
+	}
+	skynet_mq_push_batch(ctx->queue, message, n);
+	skynet_context_release(ctx);
+
+	return 0;
+}
+
 /**
  * @brief mark the module exit if context marked with endless
  * @param[in] handle of the module
@@ -337,15 +404,19 @@ static void
 dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	assert(ctx->init);
 	CHECKCALLING_BEGIN(ctx)
-	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));
+	T_handle = ctx->handle;
+	malloc_current(ctx->memory);
 	int type = msg->sz >> HANDLE_REMOTE_SHIFT;
 	size_t sz = msg->sz & HANDLE_MASK;
 	if (ctx->logfile) {
 		skynet_log_output(ctx->logfile, msg->source, type, msg->session, msg->data, sz);
 	}
-	if (!ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz)) {
+	// the header of socket data is freed with the payload by its owner, see skynet_socket_buffer_free
+	int embedded = type == PTYPE_SOCKET && SKYNET_SOCKET_EMBEDDED(((struct skynet_socket_message *)msg->data)->type);
+	if (!ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz) && !embedded) {
 		skynet_free(msg->data);
 	} 
+	malloc_current(NULL);
 	CHECKCALLING_END(ctx)
 }
 
@@ -365,12 +436,33 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+/**
+ * @brief monotonic time in nanosecond, for time slice
+ */
+static uint64_t
+now_ns(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000000 + ti.tv_nsec;
+}
+
+/**
+ * @brief set the time budget of one dispatch slice
+ * @param[in] ns nanosecond, 0 for disable (the batch size depends on weight only)
+ */
+void
+skynet_context_timeslice(uint64_t ns) {
+	G_NODE.timeslice = ns;
+}
+
 /**
  * @brief try to pop msg queue from global queue, them pop msg from the message queue and deal with it
  * @param[in] s module manager
  * @param[in] q message queue for module
  * @param[in] weight used to deal with the num of msg pop out every loop
- *
+ * @note high priority queue pops twice the batch (weight - 1, the whole queue at most), low priority
+ *	queue pops one message. If timeslice is set, the slice stops when the time budget used out instead
+ *	of the weight, and the budget is x4 for high priority, /4 for low priority.
  */
 struct message_queue * 
 skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
@@ -399,6 +491,24 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 
 	int i,n=1;
 	struct skynet_message msg;
+	int priority = skynet_mq_priority(q);
+	uint64_t budget = G_NODE.timeslice;
+	uint64_t start = 0;
+	if (budget) {
+		weight = 0;
+		if (priority == MQ_PRIORITY_HIGH) {
+			budget *= 4;
+		} else if (priority == MQ_PRIORITY_LOW) {
+			budget /= 4;
+		}
+		start = now_ns();
+	} else if (priority == MQ_PRIORITY_HIGH) {
+		if (weight > 0) {
+			--weight;
+		}
+	} else if (priority == MQ_PRIORITY_LOW) {
+		weight = -1;
+	}
 	/*tot nums of msg pop out by weight and payload*/
 	for (i=0;i<n;i++) {
 		/*try to pop one msg*/
@@ -435,6 +545,11 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 		}
 		/*update monitor, as a watch dog for module*/
 		skynet_monitor_trigger(sm, 0,0);
+
+		/*time budget of this slice used out*/
+		if (budget && now_ns() - start >= budget) {
+			break;
+		}
 	}
 
 	assert(q == ctx->queue);
@@ -539,6 +654,36 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+/**
+ * @brief register timer of milliseconds for session
+ * @param[in] context module handle
+ * @param[in] param milliseconds
+ */
+static const char *
+cmd_timeout_ms(struct skynet_context * context, const char * param) {
+	int ms = strtol(param, NULL, 10);
+	int session = skynet_context_newsession(context);
+	skynet_timeout_ms(context->handle, ms, session);
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
+/**
+ * @brief cancel the timer of session registered by TIMEOUT
+ * @param[in] context module handle
+ * @param[in] param session of the timer
+ * @return NULL if the timer is expired already
+ */
+static const char *
+cmd_cancel(struct skynet_context * context, const char * param) {
+	int session = strtol(param, NULL, 10);
+	if (skynet_timeout_cancel(context->handle, session)) {
+		return NULL;
+	}
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
 /**
  * @brief try to register 'name string = handle' into module manager
  * @param[in] context handle of the module
@@ -600,6 +745,13 @@ cmd_now(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+static const char *
+cmd_now_ms(struct skynet_context * context, const char * param) {
+	uint32_t ti = skynet_gettime_ms();
+	sprintf(context->result,"%u",ti);
+	return context->result;
+}
+
 static const char *
 cmd_exit(struct skynet_context * context, const char * param) {
 	handle_exit(context, 0);
@@ -778,12 +930,102 @@ cmd_signal(struct skynet_context * context, const char * param) {
 	return NULL;
 }
 
+/**
+ * @brief query a runtime counter of skynet node
+ * @param[in] context handle of the module
+ * @param[in] param name of the counter (park, wakeup, spurious, spin)
+ *
+ */
+static const char *
+cmd_stat(struct skynet_context * context, const char * param) {
+	if (param == NULL) {
+		return NULL;
+	}
+	struct skynet_park_stat ps;
+	struct socket_buffer_stat bs;
+	skynet_park_stat(&ps);
+	socket_buffer_stat(&bs);
+	long long v;
+	if (strcmp(param, "park") == 0) {
+		v = ps.park;
+	} else if (strcmp(param, "wakeup") == 0) {
+		v = ps.wakeup;
+	} else if (strcmp(param, "spurious") == 0) {
+		v = ps.spurious;
+	} else if (strcmp(param, "spin") == 0) {
+		v = ps.spin;
+	} else if (strcmp(param, "netbuf_alloc") == 0) {
+		v = bs.alloc;
+	} else if (strcmp(param, "netbuf_hit") == 0) {
+		v = bs.hit;
+	} else if (strcmp(param, "netbuf_inflight") == 0) {
+		v = bs.inflight;
+	} else if (strcmp(param, "netbuf_slab") == 0) {
+		v = bs.slab;
+	} else {
+		return NULL;
+	}
+	sprintf(context->result, "%lld", v);
+	return context->result;
+}
+
+/**
+ * @brief bind the message queue of this module to a numa node (config numa = true)
+ * @param[in] context handle of the module
+ * @param[in] param node id, -1 for any
+ * @note only the workers of the node run the module after it, but the memory allocated before
+ *       (the queue, the lua state) is not moved, and the allocator arenas are per thread, not per node
+ *
+ */
+static const char *
+cmd_numa(struct skynet_context * context, const char * param) {
+	if (param == NULL || param[0] == '\0') {
+		return NULL;
+	}
+	int node = strtol(param, NULL, 10);
+	if (skynet_mq_setnode(context->queue, node)) {
+		skynet_error(context, "Can't bind to numa node %d", node);
+		return NULL;
+	}
+	sprintf(context->result, "%d", node);
+	return context->result;
+}
+
+/**
+ * @brief set (or query) the priority class of this module
+ * @param[in] context handle of the module
+ * @param[in] param high, normal or low, empty for query
+ *
+ */
+static const char *
+cmd_priority(struct skynet_context * context, const char * param) {
+	static const char * name[] = { "low", "normal", "high" };
+	if (param && param[0]) {
+		int i;
+		for (i=0;i<3;i++) {
+			if (strcmp(param, name[i]) == 0) {
+				break;
+			}
+		}
+		if (i == 3) {
+			skynet_error(context, "Invalid priority %s", param);
+			return NULL;
+		}
+		skynet_mq_setpriority(context->queue, i + MQ_PRIORITY_LOW);
+	}
+	strcpy(context->result, name[skynet_mq_priority(context->queue) - MQ_PRIORITY_LOW]);
+	return context->result;
+}
+
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "TIMEOUTMS", cmd_timeout_ms },
+	{ "CANCEL", cmd_cancel },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
 	{ "NOW", cmd_now },
+	{ "NOWMS", cmd_now_ms },
 	{ "EXIT", cmd_exit },
 	{ "KILL", cmd_kill },
 	{ "LAUNCH", cmd_launch },
@@ -797,6 +1039,9 @@ static struct command_func cmd_funcs[] = {
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
+	{ "STAT", cmd_stat },
+	{ "NUMA", cmd_numa },
+	{ "PRIORITY", cmd_priority },
 	{ NULL, NULL },
 };
 
@@ -906,6 +1151,30 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	return session;
 }
 
+/**
+ * @brief find the handle of a local name, cached in the context
+ * @note only the thread dispatching the context calls it
+ */
+static uint32_t
+context_findname(struct skynet_context * context, const char * name) {
+	uint32_t version = skynet_handle_nameversion();
+	size_t sz = strlen(name);
+	if (sz >= NAME_CACHE_LENGTH) {
+		return skynet_handle_findname(name);
+	}
+	struct name_cache *c = &context->name_cache[(sz + (unsigned char)name[0] + (unsigned char)name[sz/2]) % NAME_CACHE_SIZE];
+	if (c->handle && c->version == version && memcmp(c->name, name, sz+1) == 0) {
+		return c->handle;
+	}
+	uint32_t handle = skynet_handle_findname(name);
+	if (handle) {
+		c->version = version;
+		c->handle = handle;
+		memcpy(c->name, name, sz+1);
+	}
+	return handle;
+}
+
 /**
  * @brief send msg to other module by name
  * @param[in] contex module handle
@@ -927,7 +1196,7 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 	if (addr[0] == ':') {
 		des = strtoul(addr+1, NULL, 16);
 	} else if (addr[0] == '.') {
-		des = skynet_handle_findname(addr + 1);
+		des = context_findname(context, addr + 1);
 		if (des == 0) {
 			if (type & PTYPE_TAG_DONTCOPY) {
 				skynet_free(data);
@@ -961,6 +1230,14 @@ skynet_context_handle(struct skynet_context *ctx) {
 	return ctx->handle;
 }
 
+/**
+ * @brief memory counter of the module, see malloc_hook.c
+ */
+struct malloc_stat *
+skynet_context_memory(struct skynet_context *ctx) {
+	return ctx->memory;
+}
+
 /**
  * @breif reigster the callback and module structure into module manager 
  * @param[in] cotext module manager
@@ -1008,29 +1285,23 @@ skynet_globalinit(void) {
 	G_NODE.monitor_exit = 0;
 
 	G_NODE.init = 1;
-	if (pthread_key_create(&G_NODE.handle_key, NULL)) {
-		fprintf(stderr, "pthread_key_create failed");
-		exit(1);
-	}
-	// set mainthread's key
+	// set mainthread's handle
 	skynet_initthread(THREAD_MAIN);
 }
 
 /***
- * @brief delete share area for thread
+ * @brief release the node, the handle of thread is a __thread variable, nothing to delete now
  */
 void 
 skynet_globalexit(void) {
-	pthread_key_delete(G_NODE.handle_key);
 }
 
 /** 
- * @brief push -v into thread share area
+ * @brief set -m as the handle of this thread
  *
  */
 void
 skynet_initthread(int m) {
-	uintptr_t v = (uint32_t)(-m);
-	pthread_setspecific(G_NODE.handle_key, (void *)v);
+	T_handle = (uint32_t)(-m);
 }
 
@@ -7,16 +7,20 @@
 struct skynet_context;
 struct skynet_message;
 struct skynet_monitor;
+struct malloc_stat;
 
 struct skynet_context * skynet_context_new(const char * name, const char * parm);
 void skynet_context_grab(struct skynet_context *);
 void skynet_context_reserve(struct skynet_context *ctx);
 struct skynet_context * skynet_context_release(struct skynet_context *);
 uint32_t skynet_context_handle(struct skynet_context *);
+struct malloc_stat * skynet_context_memory(struct skynet_context *);
 int skynet_context_push(uint32_t handle, struct skynet_message *message);
+int skynet_context_push_batch(uint32_t handle, struct skynet_message *message, int n);
 void skynet_context_send(struct skynet_context * context, void * msg, size_t sz, uint32_t source, int type, int session);
 int skynet_context_newsession(struct skynet_context *);
 struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *, int weight);	// return next queue
+void skynet_context_timeslice(uint64_t ns);
 int skynet_context_total();
 void skynet_context_dispatchall(struct skynet_context * context);	// for skynet_error output before exit
 
@@ -7,6 +7,7 @@
 
 #include "skynet_socket.h"
 #include "socket_server.h"
+#include "socket_buffer.h"
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_harbor.h"
@@ -16,18 +17,91 @@
 #include <string.h>
 #include <stdbool.h>
 
+#define MAX_SOCKET_SHARD 64                 /*max socket threads*/
+
 /**
- * @brief handle in local
+ * @brief listen sockets of all shards opened with SO_REUSEPORT for one port
  */
-static struct socket_server * SOCKET_SERVER = NULL;
+struct listen_group {
+	int id;                             /*id of the first listen socket, the module only knows it*/
+	int n;                              /*tot members*/
+	int member[MAX_SOCKET_SHARD];       /*listen socket id of the other shards*/
+	struct listen_group *next;
+};
+
+/**
+ * @brief message wait to push, sorted by handle to push in batch
+ */
+struct socket_forward {
+	uint32_t handle;                    /*module the message push to*/
+	int seq;                            /*keep the order of the same handle*/
+	struct skynet_message message;
+};
+
+/**
+ * @brief messages collected by one socket thread before push
+ */
+struct socket_batch {
+	int n;                              /*messages in forward*/
+	struct socket_forward *forward;     /*size is SOCKET_BATCH*/
+	struct skynet_message *message;     /*messages of one handle, used by push*/
+};
+
+/**
+ * @brief handle in local, one socket server for each socket thread
+ */
+static struct socket_server ** SOCKET_SERVER = NULL;
+static int SOCKET_SHARD = 0;                /*tot socket servers*/
+static int REUSEPORT = 0;                   /*listen in all shards with SO_REUSEPORT*/
+static unsigned NEXT_SHARD = 0;             /*round robin counter for new sockets*/
+static int GROUP_LOCK = 0;
+static struct listen_group * LISTEN_GROUP = NULL;
+static int SOCKET_BATCH = 1;                /*max messages collected before push, 1 for push one by one*/
+static struct socket_batch * BATCH = NULL;  /*one for each socket thread*/
+
+/*the socket server the socket id belongs to*/
+#define SERVER(id) (SOCKET_SERVER[(unsigned)(id) % SOCKET_SHARD])
 
 /**
  * @brief init the socket manager
- * return the handle of the socket manager
+ * @param[in] nshard tot socket threads
+ * @param[in] reuseport listen in every socket thread with SO_REUSEPORT
+ * @param[in] max_event max events of one epoll wait, 0 for default
+ * @param[in] batch max messages collected by the socket thread before push to the modules
+ * @param[in] slot initial sockets of each socket thread
+ * @param[in] max_slot max sockets of each socket thread, 0 for default
+ * @param[in] max_accept max connections accepted for one readiness of the listen socket
+ * @param[in] rawaddr report the peer address of accepted socket unformatted, see skynet_socket_address
+ * @return tot socket servers, each needs a socket thread
  */
-void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create();
+int 
+skynet_socket_init(int nshard, int reuseport, int max_event, int batch, int slot, int max_slot, int max_accept, int rawaddr) {
+	int i;
+	if (nshard < 1) {
+		nshard = 1;
+	} else if (nshard > MAX_SOCKET_SHARD) {
+		nshard = MAX_SOCKET_SHARD;
+	}
+	assert(sizeof(struct skynet_socket_message) <= SOCKET_BUFFER_HEADER);
+	socket_buffer_init(nshard);
+	SOCKET_SERVER = skynet_malloc(nshard * sizeof(struct socket_server *));
+	for (i=0;i<nshard;i++) {
+		SOCKET_SERVER[i] = socket_server_create(i, nshard, max_event, slot, max_slot);
+		socket_server_accept(SOCKET_SERVER[i], max_accept, rawaddr);
+	}
+	SOCKET_BATCH = batch > 1 ? batch : 1;
+	BATCH = skynet_malloc(nshard * sizeof(struct socket_batch));
+	for (i=0;i<nshard;i++) {
+		BATCH[i].n = 0;
+		BATCH[i].forward = skynet_malloc(SOCKET_BATCH * sizeof(struct socket_forward));
+		BATCH[i].message = skynet_malloc(SOCKET_BATCH * sizeof(struct skynet_message));
+	}
+	for (i=0;i<nshard;i++) {
+		socket_server_peer(SOCKET_SERVER[i], SOCKET_SERVER);
+	}
+	SOCKET_SHARD = nshard;
+	REUSEPORT = reuseport;
+	return nshard;
 }
 
 /**
@@ -35,7 +109,10 @@ skynet_socket_init() {
  */
 void
 skynet_socket_exit() {
-	socket_server_exit(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		socket_server_exit(SOCKET_SERVER[i]);
+	}
 }
 
 /**
@@ -43,29 +120,147 @@ skynet_socket_exit() {
  */
 void
 skynet_socket_free() {
-	socket_server_release(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		socket_server_release(SOCKET_SERVER[i]);
+		skynet_free(BATCH[i].forward);
+		skynet_free(BATCH[i].message);
+	}
+	skynet_free(BATCH);
+	BATCH = NULL;
+	skynet_free(SOCKET_SERVER);
 	SOCKET_SERVER = NULL;
+	SOCKET_SHARD = 0;
+	socket_buffer_release();
+	while (LISTEN_GROUP) {
+		struct listen_group *g = LISTEN_GROUP;
+		LISTEN_GROUP = g->next;
+		skynet_free(g);
+	}
+}
+
+/**
+ * @brief socket server for a new socket, by turns
+ */
+static inline struct socket_server *
+next_server() {
+	return SOCKET_SERVER[__sync_fetch_and_add(&NEXT_SHARD, 1) % SOCKET_SHARD];
+}
+
+/**
+ * @brief copy the members of listen group
+ * @param[in] id id of the group
+ * @param[out] member members of the group
+ * @param[in] remove remove the group
+ * @return tot members, 0 if id is not a group
+ */
+static int
+group_member(int id, int member[MAX_SOCKET_SHARD], bool remove) {
+	int n = 0;
+	if (LISTEN_GROUP == NULL) {
+		return 0;
+	}
+	while (__sync_lock_test_and_set(&GROUP_LOCK,1)) {}
+	struct listen_group **prev = &LISTEN_GROUP;
+	struct listen_group *g;
+	while ((g = *prev) != NULL) {
+		if (g->id == id) {
+			n = g->n;
+			memcpy(member, g->member, n * sizeof(int));
+			if (remove) {
+				*prev = g->next;
+			}
+			break;
+		}
+		prev = &g->next;
+	}
+	__sync_lock_release(&GROUP_LOCK);
+	if (g && remove) {
+		skynet_free(g);
+	}
+	return n;
 }
 
 // mainloop thread
+/**
+ * @brief free the message can't be pushed
+ */
+static void
+drop_message(struct skynet_socket_message *sm) {
+	if (SKYNET_SOCKET_EMBEDDED(sm->type)) {
+		socket_buffer_free(sm->buffer);
+	} else {
+		skynet_free(sm->buffer);
+		skynet_free(sm);
+	}
+}
+
+static int
+compare_forward(const void *a, const void *b) {
+	const struct socket_forward *fa = a;
+	const struct socket_forward *fb = b;
+	if (fa->handle != fb->handle) {
+		return fa->handle < fb->handle ? -1 : 1;
+	}
+	return fa->seq - fb->seq;
+}
+
+/**
+ * @brief push the messages collected, one queue operation for each module
+ * @param[in] b batch of the socket thread
+ */
+static void
+flush_batch(struct socket_batch *b) {
+	int n = b->n;
+	if (n == 0) {
+		return;
+	}
+	b->n = 0;
+	if (n > 1) {
+		qsort(b->forward, n, sizeof(struct socket_forward), compare_forward);
+	}
+	int i, start = 0;
+	for (i=1;i<=n;i++) {
+		if (i == n || b->forward[i].handle != b->forward[start].handle) {
+			int j;
+			for (j=start;j<i;j++) {
+				b->message[j-start] = b->forward[j].message;
+			}
+			if (skynet_context_push_batch(b->forward[start].handle, b->message, i - start)) {
+				for (j=0;j<i-start;j++) {
+					drop_message(b->message[j].data);
+				}
+			}
+			start = i;
+		}
+	}
+}
+
 /**
  * @brief forward the msg to the usr module 
+ * @param[in] b batch of the socket thread
  * @param[in] type what happened 
  * @param[in] padding store payload after msg ?
  * @param[in] result result msg wait to send 
  */
 static void
-forward_message(int type, bool padding, struct socket_message * result) {
+forward_message(struct socket_batch *b, int type, bool padding, struct socket_message * result) {
 	struct skynet_socket_message *sm;
 	int sz = sizeof(*sm);
-	if (padding) {
-		if (result->data) {
-			sz += strlen(result->data);
-		} else {
-			result->data = "";
+	if (SKYNET_SOCKET_EMBEDDED(type)) {
+		// the payload is alloc by socket_buffer_alloc, store the header in the room before it
+		sm = (struct skynet_socket_message *)(result->data - SOCKET_BUFFER_HEADER);
+	} else {
+		if (padding) {
+			if (result->data) {
+				int rawsz = type == SKYNET_SOCKET_TYPE_ACCEPT ? socket_server_rawaddr_size(result->data) : 0;
+				sz += rawsz > 0 ? rawsz : strlen(result->data);
+			} else {
+				result->data = "";
+			}
 		}
+		sm = (struct skynet_socket_message *)skynet_malloc(sz);
 	}
-	sm = (struct skynet_socket_message *)skynet_malloc(sz);
 	sm->type = type;            //msg type
 	sm->id = result->id;        //msg id
 	sm->ud = result->ud;
@@ -84,22 +279,56 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	message.data = sm;
 	/*node id in high 8bits*/
 	message.sz = sz | PTYPE_SOCKET << HANDLE_REMOTE_SHIFT;
+
+	if (SOCKET_BATCH > 1) {
+		/*push later with the messages to the same module*/
+		struct socket_forward *f = &b->forward[b->n];
+		f->handle = (uint32_t)result->opaque;
+		f->seq = b->n;
+		f->message = message;
+		++b->n;
+		return;
+	}
 	
 	//push the msg into queue to the module
 	if (skynet_context_push((uint32_t)result->opaque, &message)) {
 		// don't call skynet_socket_close here (It will block mainloop)
-		skynet_free(sm->buffer);
+		drop_message(sm);
+	}
+}
+
+/**
+ * @brief free the payload of DATA or UDP message, the message header is freed with it
+ * @param[in] buffer payload of the message
+ */
+void
+skynet_socket_buffer_free(void *buffer) {
+	socket_buffer_free(buffer);
+}
+
+/**
+ * @brief free the message of PTYPE_SOCKET, only the payload if the header is embedded in it
+ * @param[in] sm the message
+ */
+void
+skynet_socket_message_free(struct skynet_socket_message *sm) {
+	if (SKYNET_SOCKET_EMBEDDED(sm->type)) {
+		socket_buffer_free(sm->buffer);
+	} else {
 		skynet_free(sm);
 	}
 }
 
 /**
  *  @brief deal with the msg from usr, forward the result msg to the module 
+ *  @param[in] shard index of the socket thread
+ *  @note in batch mode, the results are collected until SOCKET_BATCH or nothing ready, then pushed together
  */
 int 
-skynet_socket_poll() {
-	struct socket_server *ss = SOCKET_SERVER;
-	assert(ss);
+skynet_socket_poll(int shard) {
+	assert(shard >= 0 && shard < SOCKET_SHARD);
+	struct socket_server *ss = SOCKET_SERVER[shard];
+	struct socket_batch *b = &BATCH[shard];
 	/*result used to hold return msg from the socket_server_poll*/
 	struct socket_message result;
 	int more = 1;
@@ -107,32 +336,49 @@ skynet_socket_poll() {
 	/*wait evnet occured, and solve the event with the result msg as return */
 	int type = socket_server_poll(ss, &result, &more);
 
-	/*forward the result msg recive */
-	switch (type) {
-	case SOCKET_EXIT:   /*close the socket manager*/
-		return 0;
-	case SOCKET_DATA:   /*forward payload recive from tcp*/
-		forward_message(SKYNET_SOCKET_TYPE_DATA, false, &result);
-		break;
-	case SOCKET_CLOSE:  /*forward socket close notice*/
-		forward_message(SKYNET_SOCKET_TYPE_CLOSE, false, &result);
-		break;
-	case SOCKET_OPEN:   /*forward socket open info*/
-		forward_message(SKYNET_SOCKET_TYPE_CONNECT, true, &result);
-		break;
-	case SOCKET_ERROR:  /*forward socket error info*/
-		forward_message(SKYNET_SOCKET_TYPE_ERROR, false, &result);
-		break;
-	case SOCKET_ACCEPT: /*forward socket accept msg*/
-		forward_message(SKYNET_SOCKET_TYPE_ACCEPT, true, &result);
-		break;
-	case SOCKET_UDP:   /*forward payload recive from udp*/
-		forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result);
-		break;
-	default:           /*unknown msg type*/
-		skynet_error(NULL, "Unknown socket message type %d.",type);
-		return -1;
+	for (;;) {
+		/*forward the result msg recive */
+		switch (type) {
+		case SOCKET_EXIT:   /*close the socket manager*/
+			flush_batch(b);
+			return 0;
+		case SOCKET_DATA:   /*forward payload recive from tcp*/
+			forward_message(b, SKYNET_SOCKET_TYPE_DATA, false, &result);
+			break;
+		case SOCKET_CLOSE:  /*forward socket close notice*/
+			forward_message(b, SKYNET_SOCKET_TYPE_CLOSE, false, &result);
+			break;
+		case SOCKET_OPEN:   /*forward socket open info*/
+			forward_message(b, SKYNET_SOCKET_TYPE_CONNECT, true, &result);
+			break;
+		case SOCKET_ERROR:  /*forward socket error info*/
+			forward_message(b, SKYNET_SOCKET_TYPE_ERROR, false, &result);
+			break;
+		case SOCKET_ACCEPT: /*forward socket accept msg*/
+			forward_message(b, SKYNET_SOCKET_TYPE_ACCEPT, true, &result);
+			break;
+		case SOCKET_UDP:   /*forward payload recive from udp*/
+			forward_message(b, SKYNET_SOCKET_TYPE_UDP, false, &result);
+			break;
+		case SOCKET_WARNING: /*forward write buffer watermark crossed*/
+			forward_message(b, SKYNET_SOCKET_TYPE_WARNING, false, &result);
+			break;
+		default:           /*unknown msg type*/
+			flush_batch(b);
+			skynet_error(NULL, "Unknown socket message type %d.",type);
+			return -1;
+		}
+		if (b->n == 0 || b->n >= SOCKET_BATCH) {
+			break;
+		}
+		/*collect the results ready without wait*/
+		type = socket_server_trypoll(ss, &result);
+		if (type == -1) {
+			break;
+		}
 	}
+	flush_batch(b);
+
 	/*exit when more is ture*/
 	if (more) {
 		return -1;
@@ -168,7 +414,7 @@ check_wsz(struct skynet_context *ctx, int id, void *buffer, int64_t wsz) {
  */
 int
 skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	int64_t wsz = socket_server_send(SOCKET_SERVER, id, buffer, sz);
+	int64_t wsz = socket_server_send(SERVER(id), id, buffer, sz);
 	return check_wsz(ctx, id, buffer, wsz);
 }
 
@@ -183,7 +429,7 @@ skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
  */
 void
 skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
+	socket_server_send_lowpriority(SERVER(id), id, buffer, sz);
 }
 
 /**
@@ -198,7 +444,32 @@ skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer,
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
+	struct socket_server *ss = next_server();
+	if (!REUSEPORT || SOCKET_SHARD == 1) {
+		return socket_server_listen(ss, source, host, port, backlog);
+	}
+	int id = socket_server_listen_reuseport(ss, source, host, port, backlog, -1);
+	if (id < 0) {
+		return id;
+	}
+	/*listen the same port in the other shards, the module only knows id*/
+	struct listen_group *g = skynet_malloc(sizeof(*g));
+	g->id = id;
+	g->n = 0;
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		if (SOCKET_SERVER[i] != ss) {
+			int member = socket_server_listen_reuseport(SOCKET_SERVER[i], source, host, port, backlog, id);
+			if (member >= 0) {
+				g->member[g->n++] = member;
+			}
+		}
+	}
+	while (__sync_lock_test_and_set(&GROUP_LOCK,1)) {}
+	g->next = LISTEN_GROUP;
+	LISTEN_GROUP = g;
+	__sync_lock_release(&GROUP_LOCK);
+	return id;
 }
 
 
@@ -215,7 +486,7 @@ skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
         /*index of the of module*/
 	uint32_t source = skynet_context_handle(ctx);
 	/*source as the the opaque*/
-	return socket_server_connect(SOCKET_SERVER, source, host, port);
+	return socket_server_connect(next_server(), source, host, port);
 }
 
 /**
@@ -228,7 +499,7 @@ skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 int 
 skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_bind(SOCKET_SERVER, source, fd);
+	return socket_server_bind(next_server(), source, fd);
 }
 
 /**
@@ -240,7 +511,12 @@ skynet_socket_bind(struct skynet_context *ctx, int fd) {
 void 
 skynet_socket_close(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_close(SOCKET_SERVER, source, id);
+	int member[MAX_SOCKET_SHARD];
+	int i, n = group_member(id, member, true);
+	for (i=0;i<n;i++) {
+		socket_server_close(SERVER(member[i]), source, member[i]);
+	}
+	socket_server_close(SERVER(id), source, id);
 }
 
 /**
@@ -252,7 +528,12 @@ skynet_socket_close(struct skynet_context *ctx, int id) {
 void 
 skynet_socket_start(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_start(SOCKET_SERVER, source, id);
+	int member[MAX_SOCKET_SHARD];
+	int i, n = group_member(id, member, false);
+	for (i=0;i<n;i++) {
+		socket_server_start(SERVER(member[i]), source, member[i]);
+	}
+	socket_server_start(SERVER(id), source, id);
 }
 
 /**
@@ -263,7 +544,20 @@ skynet_socket_start(struct skynet_context *ctx, int id) {
  */
 void
 skynet_socket_nodelay(struct skynet_context *ctx, int id) {
-	socket_server_nodelay(SOCKET_SERVER, id);
+	socket_server_nodelay(SERVER(id), id);
+}
+
+/**
+ *  @brief set the watermarks of the write buffer, the module gets SKYNET_SOCKET_TYPE_WARNING when crossing them
+ *  @param[in] ctx handle of the module
+ *  @param[in] id socket id
+ *  @param[in] high bytes wait to send reach it, 0 for disable
+ *  @param[in] low bytes wait to send fall to it
+ *  @note api for usr
+ */
+void
+skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t high, int64_t low) {
+	socket_server_watermark(SERVER(id), id, high, low);
 }
 
 /**
@@ -276,7 +570,7 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp(next_server(), source, addr, port);
 }
 
 /**
@@ -288,7 +582,7 @@ skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
  */
 int 
 skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port) {
-	return socket_server_udp_connect(SOCKET_SERVER, id, addr, port);
+	return socket_server_udp_connect(SERVER(id), id, addr, port);
 }
 
 /**
@@ -301,7 +595,7 @@ skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr,
  */
 int 
 skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz) {
-	int64_t wsz = socket_server_udp_send(SOCKET_SERVER, id, (const struct socket_udp_address *)address, buffer, sz);
+	int64_t wsz = socket_server_udp_send(SERVER(id), id, (const struct socket_udp_address *)address, buffer, sz);
 	return check_wsz(ctx, id, (void *)buffer, wsz);
 }
 
@@ -319,5 +613,18 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	sm.opaque = 0;
 	sm.ud = msg->ud;
 	sm.data = msg->buffer;
-	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
+	return (const char *)socket_server_udp_address(SERVER(sm.id), &sm, addrsz);
+}
+
+/**
+ * @brief format the peer address of the accept msg
+ * @param[in] addr payload of SKYNET_SOCKET_TYPE_ACCEPT, unformatted if rawaddr (see skynet_socket_init)
+ * @param[in] addrsz bytes of addr
+ * @param[out] buffer where to store "ip:port"
+ * @param[in] sz size of buffer
+ * @return buffer, or NULL if addr is invalid
+ */
+const char *
+skynet_socket_address(const char *addr, int addrsz, char *buffer, int sz) {
+	return socket_server_format_address(addr, addrsz, buffer, sz);
 }
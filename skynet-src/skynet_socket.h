@@ -1,6 +1,8 @@
 #ifndef skynet_socket_h
 #define skynet_socket_h
 
+#include <stdint.h>
+
 struct skynet_context;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
@@ -9,6 +11,12 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ACCEPT 4
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
+// ud is the KB wait to send when it rises to the high watermark, 0 when it falls to the low watermark
+#define SKYNET_SOCKET_TYPE_WARNING 7
+
+// the header of DATA and UDP message is in the same buffer of the payload,
+// the message is freed by skynet_socket_buffer_free(buffer) after the payload used.
+#define SKYNET_SOCKET_EMBEDDED(type) ((type) == SKYNET_SOCKET_TYPE_DATA || (type) == SKYNET_SOCKET_TYPE_UDP)
 
 /**
  *  @brief msg for usr layer
@@ -21,10 +29,12 @@ struct skynet_socket_message {
 	char * buffer;      /*payload*/
 };
 
-void skynet_socket_init();
+int skynet_socket_init(int nshard, int reuseport, int max_event, int batch, int slot, int max_slot, int max_accept, int rawaddr);
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int shard);
+void skynet_socket_buffer_free(void *buffer);
+void skynet_socket_message_free(struct skynet_socket_message *sm);
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 void skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
@@ -34,10 +44,13 @@ int skynet_socket_bind(struct skynet_context *ctx, int fd);
 void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t high, int64_t low);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
 int skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz);
 const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addrsz);
+// the peer address of the accept msg is "ip:port", or in udp address format if socket_rawaddr is set in config
+const char * skynet_socket_address(const char *addr, int addrsz, char *buffer, int sz);
 
 #endif
@@ -8,6 +8,9 @@
 #include "skynet_monitor.h"
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
+#include "skynet_park.h"
+#include "skynet_affinity.h"
+#include "malloc_hook.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -16,6 +19,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
+
 /**
  * @brief monitor manager
  *
@@ -23,9 +30,8 @@
 struct monitor {
 	int count;                        /*tot nums of moniter*/
 	struct skynet_monitor ** m;       /*storage of monitor*/
-	pthread_cond_t cond;              /*condition lock*/ 
-	pthread_mutex_t mutex;            /*mutex lock*/
-	int sleep;                        /*record thread drop into sleep*/
+	int socket_cpu;                   /*cpu of socket thread, -1 for not pinned*/
+	int timer_cpu;                    /*cpu of timer thread, -1 for not pinned*/
 };
 
 /**
@@ -35,6 +41,15 @@ struct worker_parm {
 	struct monitor *m;               /*montior hhandle*/       
 	int id;                          /*id of this module*/
 	int weight;                      /*weight of queue of this module*/
+	int cpu;                         /*cpu to pin, -1 for not pinned*/
+};
+
+/**
+ * @brief param of socket thread
+ */
+struct socket_parm {
+	struct monitor *m;               /*montior hhandle*/
+	int shard;                       /*index of the socket server it polls*/
 };
 
 #define CHECK_ABORT if (skynet_context_total()==0) break;
@@ -53,39 +68,27 @@ create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg) {
 	}
 }
 
-/**
- * @brief try to wake up one thread
- * @param[in] m monitor manager
- * @param[in] busy 
- *
- */
-static void
-wakeup(struct monitor *m, int busy) {
-	if (m->sleep >= m->count - busy) {
-		// signal sleep worker, "spurious wakeup" is harmless
-		pthread_cond_signal(&m->cond);
-	}
-}
-
 /**
  * @brief socket thread 
- * @param[in] p monitor of this module
+ * @param[in] p param of this socket thread
  */
 static void *
 _socket(void *p) {
-	struct monitor * m = p;
+	struct socket_parm * sp = p;
+	struct monitor * m = sp->m;
 	skynet_initthread(THREAD_SOCKET);
+	if (m->socket_cpu >= 0) {
+		skynet_affinity_bind(m->socket_cpu + sp->shard);
+	}
 	for (;;) {
 	        /*deal with the event*/
-		int r = skynet_socket_poll();
+		int r = skynet_socket_poll(sp->shard);
 		if (r==0)
 			break;
 		if (r<0) {
 			CHECK_ABORT
-			continue;
 		}
-		/*wakeup one when sleep thread bigger than montior*/
-		wakeup(m,0);
+		// workers are woken by skynet_globalmq_push when the messages pushed
 	}
 	return NULL;
 }
@@ -102,8 +105,6 @@ free_monitor(struct monitor *m) {
 	for (i=0;i<n;i++) {
 		skynet_monitor_delete(m->m[i]);
 	}
-	pthread_mutex_destroy(&m->mutex);
-	pthread_cond_destroy(&m->cond);
 	skynet_free(m->m);
 	skynet_free(m);
 }
@@ -133,23 +134,62 @@ _monitor(void *p) {
 }
 
 /**
- * @brief watch dog for check if need to wake up more thread when load is too heavy for the server
- *
+ * @brief create a timerfd to drive the timer thread
+ * @return -1 if timerfd is not supported
  */
+static int
+timer_createfd(void) {
+#if defined(__linux__)
+	return timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#else
+	return -1;
+#endif
+}
+
+/**
+ * @brief block until the next tick
+ * @param[in] fd timerfd, or -1 to sleep
+ * @note the deadline is computed from the timer clock every time, so the thread wakes once per tick
+ */
+static void
+timer_wait(int fd) {
+	int delay = skynet_timer_next();
+#if defined(__linux__)
+	if (fd >= 0) {
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = delay / 1000000;
+		its.it_value.tv_nsec = (delay % 1000000) * 1000;
+		uint64_t expirations;
+		if (timerfd_settime(fd, 0, &its, NULL) == 0
+			&& read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+			return;
+		}
+	}
+#endif
+	usleep(delay);
+}
+
 static void *
 _timer(void *p) {
 	struct monitor * m = p;
 	skynet_initthread(THREAD_TIMER);
+	if (m->timer_cpu >= 0) {
+		skynet_affinity_bind(m->timer_cpu);
+	}
+	int fd = timer_createfd();
 	for (;;) {
 		skynet_updatetime();
 		CHECK_ABORT
-		wakeup(m,m->count-1);
-		usleep(2500);
+		timer_wait(fd);
+	}
+	if (fd >= 0) {
+		close(fd);
 	}
 	// wakeup socket thread
 	skynet_socket_exit();
 	// wakeup all worker thread
-	pthread_cond_broadcast(&m->cond);
+	skynet_park_wakeall();
 	return NULL;
 }
 
@@ -171,44 +211,100 @@ _worker(void *p) {
 	struct skynet_monitor *sm = m->m[id]
 	/*߳˽пռ䴫THREAD_WORKER*/;
 	skynet_initthread(THREAD_WORKER);
+	skynet_globalmq_local_bind(id);
+	if (wp->cpu >= 0) {
+		skynet_affinity_bind(wp->cpu);
+	}
 	/*qΪnull*/
 	struct message_queue * q = NULL;
 	for (;;) {
 		/*ȡĳģĹ*/
 		q = skynet_context_message_dispatch(sm, q, weight);
 		if (q == NULL) {
-			if (pthread_mutex_lock(&m->mutex) == 0) {
-				++ m->sleep;
-				// "spurious wakeup" is harmless,
-				// because skynet_context_message_dispatch() can be call at any time.
-				pthread_cond_wait(&m->cond, &m->mutex);
-				-- m->sleep;
-				if (pthread_mutex_unlock(&m->mutex)) {
-					fprintf(stderr, "unlock mutex error");
-					exit(1);
-				}
-			}
-		} 
+			// spin for a while, and then park until a queue is pushed
+			malloc_flush();
+			q = skynet_park(id);
+		}
 		CHECK_ABORT
 	}
 	return NULL;
 }
 
+/**
+ * @brief parse the weight table of workers from config, like "-1,-1,0,0,1,1"
+ * @param[in] str weight list
+ * @param[out] weight weight of each worker
+ * @param[in] max num of workers
+ * @return num of weights parsed, the workers after them use weight 0
+ */
+static int
+parse_weight(const char * str, int * weight, int max) {
+	int n = 0;
+	while (*str && n < max) {
+		char * end;
+		long w = strtol(str, &end, 10);
+		if (end == str || w < -1 || w > 30) {
+			fprintf(stderr, "Invalid weight %s\n", str);
+			exit(1);
+		}
+		weight[n++] = (int)w;
+		str = end;
+		while (*str == ',' || *str == ' ') {
+			++str;
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief get the cpu to pin each worker thread, by config worker_cpu
+ * @param[in] config config of skynet
+ * @param[out] cpu cpu of each worker, -1 for not pinned
+ * @note workers should be pinned if numa enabled, use all cpus when worker_cpu is not set
+ */
+static void
+worker_affinity(struct skynet_config * config, int * cpu) {
+	int list[1024];
+	int n = 0;
+	int i;
+	if (config->worker_cpu) {
+		n = skynet_affinity_parse(config->worker_cpu, list, sizeof(list)/sizeof(list[0]));
+		if (n <= 0) {
+			fprintf(stderr, "Invalid worker_cpu %s\n", config->worker_cpu);
+			exit(1);
+		}
+	} else if (config->numa) {
+		n = skynet_affinity_ncpu();
+		if (n > sizeof(list)/sizeof(list[0])) {
+			n = sizeof(list)/sizeof(list[0]);
+		}
+		for (i=0;i<n;i++) {
+			list[i] = i;
+		}
+	}
+	for (i=0;i<config->thread;i++) {
+		cpu[i] = n > 0 ? list[i % n] : -1;
+	}
+}
+
 /**
   * @brief skynetģ̵߳ķʽ
   * @param[in] thread ̸߳
   *
   */
 static void
-_start(int thread) {
-	pthread_t pid[thread+3];
+_start(struct skynet_config * config, const int * cpu) {
+	int thread = config->thread;
+	int nsocket = config->socket_thread;
+	pthread_t pid[thread+2+nsocket];
       /*ܵļֻһ
 	  ߳skynet monitor*/
 	struct monitor *m = skynet_malloc(sizeof(*m));
 	memset(m, 0, sizeof(*m));
 	/*counter ¼ҵ̵߳*/
 	m->count = thread;
-	m->sleep = 0;
+	m->socket_cpu = config->socket_cpu;
+	m->timer_cpu = config->timer_cpu;
 
 	m->m = skynet_malloc(thread * sizeof(struct skynet_monitor *));
 	int i;
@@ -218,23 +314,16 @@ _start(int thread) {
 		m->m[i] = skynet_monitor_new();
 	}
 
-	/*ʼ*/
-	if (pthread_mutex_init(&m->mutex, NULL)) {
-		fprintf(stderr, "Init mutex error");
-		exit(1);
-	}
-
-	/*ʼ*/
-	if (pthread_cond_init(&m->cond, NULL)) {
-		fprintf(stderr, "Init cond error");
-		exit(1);
-	}
-
 	/*ҵʱӣ׽ֹ
 	   ռ3߳*/ 
 	create_thread(&pid[0], _monitor, m);
 	create_thread(&pid[1], _timer, m);
-	create_thread(&pid[2], _socket, m);
+	struct socket_parm sp[nsocket];
+	for (i=0;i<nsocket;i++) {
+		sp[i].m = m;
+		sp[i].shard = i;
+		create_thread(&pid[i+2], _socket, &sp[i]);
+	}
 
 	 /*ǰ32̵߳Ȩ*/
 	static int weight[] = { 
@@ -242,6 +331,13 @@ _start(int thread) {
 		1, 1, 1, 1, 1, 1, 1, 1, 
 		2, 2, 2, 2, 2, 2, 2, 2, 
 		3, 3, 3, 3, 3, 3, 3, 3, };
+	const int * wt = weight;
+	int nweight = sizeof(weight)/sizeof(weight[0]);
+	int cweight[thread];
+	if (config->weight) {
+		nweight = parse_weight(config->weight, cweight, thread);
+		wt = cweight;
+	}
 	/*worker_parm ṹڴŸ̵߳idȨص*/
 	struct worker_parm wp[thread];
 
@@ -250,22 +346,24 @@ _start(int thread) {
 		/**/
 		wp[i].m = m;
 		wp[i].id = i;
-		if (i < sizeof(weight)/sizeof(weight[0])) {
-			wp[i].weight= weight[i];
+		wp[i].cpu = cpu[i];
+		if (i < nweight) {
+			wp[i].weight= wt[i];
 		} else {
 			/*ĬȨص̣߳ȨΪ0*/
 			wp[i].weight = 0;
 		}
 		/*ҵ߳*/
-		create_thread(&pid[i+3], _worker, &wp[i]);
+		create_thread(&pid[i+2+nsocket], _worker, &wp[i]);
 	}
 
 	/*,ȴ*/
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+2+nsocket;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 	/*ͷżӹ*/
 	free_monitor(m);
+	skynet_park_free();
 }
 
 /**
@@ -312,15 +410,32 @@ skynet_start(struct skynet_config * config) {
 
 	/*ʼϢйṹʽ*/
 	skynet_mq_init();
+	skynet_park_init(config->thread);
+	if (config->steal) {
+		skynet_globalmq_local_init(config->thread);
+	}
+	int cpu[config->thread];
+	worker_affinity(config, cpu);
+	if (config->numa) {
+		int node[config->thread];
+		int i;
+		for (i=0;i<config->thread;i++) {
+			node[i] = skynet_affinity_node(cpu[i]);
+			skynet_park_setnode(i, node[i]);
+		}
+		skynet_globalmq_numa_init(config->thread, node);
+	}
 
 	/*ʼģṹ*/
 	skynet_module_init(config->module_path);
 
 	/*ʼʱ*/
-	skynet_timer_init();
+	skynet_timer_init(config->timer_resolution);
 
 	/*ʼ׽ȫֹṹ*/
-	skynet_socket_init();
+	config->socket_thread = skynet_socket_init(config->socket_thread, config->socket_reuseport,
+		config->socket_event, config->socket_batch, config->socket_slot, config->socket_max,
+		config->socket_accept, config->socket_rawaddr);
 	
        /*logΪĬϵģ*/
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
@@ -333,7 +448,8 @@ skynet_start(struct skynet_config * config) {
 	bootstrap(ctx, config->bootstrap);
 
 	/*̣߳ʼҵ*/
-	_start(config->thread);
+	skynet_context_timeslice(config->timeslice);
+	_start(config, cpu);
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
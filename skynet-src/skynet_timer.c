@@ -27,6 +27,12 @@ typedef void (*timer_execute_func)(void *ud,void *arg);     /*callback trigger b
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
 
+#define TIMER_SLAB 256              /*nodes alloc at once for the pool*/
+#define TIMER_HASH_SIZE 1024        /*init size of the (handle, session) index*/
+
+#define TIMER_BATCH 64              /*max messages pushed into one queue at once*/
+#define TIMER_RESOLUTION 100        /*default ticks per second, 1 tick = 1 centisecond*/
+
 /**
  * @brief store id of event in timer
  */
@@ -37,10 +43,25 @@ struct timer_event {
 
 /**
  * @brief wrap of timer_event as a node in timer list
+ * @note the timer_event is stored after the node, nodes are pooled in struct timer
  */
 struct timer_node {
-	struct timer_node *next; /*linker*/
-	uint32_t expire;         /*trigger time record*/
+	struct timer_node *next;   /*linker*/
+	uint32_t expire;           /*trigger time record*/
+	int cancel;                /*cancelled, drop it when expired*/
+	struct timer_node *hnext;  /*next node in the same hash slot*/
+	struct timer_node **hprev; /*pointer to this node in the hash slot*/
+};
+
+#define TIMER_NODE_SIZE (sizeof(struct timer_node) + sizeof(struct timer_event))
+
+/**
+ * @brief expired event, sorted by handle to push in batch
+ */
+struct timer_expire {
+	uint32_t handle;
+	int session;
+	int seq;                 /*keep the order of the same handle*/
 };
 
 /**
@@ -63,6 +84,14 @@ struct timer {
 	uint32_t starttime;     /*start time*/
 	uint64_t current_point;
 	uint64_t origin_point;
+	struct timer_node *freelist;   /*pool of nodes*/
+	struct timer_node **hash;      /*index of (handle, session) for cancel*/
+	int hash_size;
+	int hash_count;
+	struct timer_expire *expire;   /*buffer of dispatch, only used by timer thread*/
+	int expire_cap;
+	uint32_t resolution;           /*ticks per second*/
+	uint32_t scale;                /*ticks per centisecond*/
 };
 
 static struct timer * TI = NULL; /*local handle for all timer event*/
@@ -116,29 +145,132 @@ add_node(struct timer *T,struct timer_node *node) {
 	}
 }
 
+static inline struct timer_node **
+hash_slot(struct timer *T, uint32_t handle, int session) {
+	uint32_t h = handle * 2654435761u ^ (uint32_t)session;
+	return &T->hash[h & (T->hash_size - 1)];
+}
+
+static inline struct timer_event *
+node_event(struct timer_node *node) {
+	return (struct timer_event *)(node+1);
+}
+
+static void
+hash_insert(struct timer *T, struct timer_node *node) {
+	struct timer_event *event = node_event(node);
+	struct timer_node **slot = hash_slot(T, event->handle, event->session);
+	node->hnext = *slot;
+	if (node->hnext) {
+		node->hnext->hprev = &node->hnext;
+	}
+	node->hprev = slot;
+	*slot = node;
+}
+
+static inline void
+hash_remove(struct timer_node *node) {
+	*node->hprev = node->hnext;
+	if (node->hnext) {
+		node->hnext->hprev = node->hprev;
+	}
+}
+
+/**
+ * @brief double the size of index when it's crowded
+ */
+static void
+hash_expand(struct timer *T) {
+	struct timer_node ** old = T->hash;
+	int old_size = T->hash_size;
+	T->hash_size *= 2;
+	T->hash = skynet_malloc(T->hash_size * sizeof(struct timer_node *));
+	memset(T->hash, 0, T->hash_size * sizeof(struct timer_node *));
+	int i;
+	for (i=0;i<old_size;i++) {
+		struct timer_node *node = old[i];
+		while (node) {
+			struct timer_node *next = node->hnext;
+			hash_insert(T, node);
+			node = next;
+		}
+	}
+	skynet_free(old);
+}
+
+/**
+ * @brief get a node from the pool, alloc TIMER_SLAB nodes when it's empty
+ * @note lock T before call it
+ */
+static struct timer_node *
+node_alloc(struct timer *T) {
+	struct timer_node *node = T->freelist;
+	if (node == NULL) {
+		char * slab = skynet_malloc(TIMER_NODE_SIZE * TIMER_SLAB);
+		int i;
+		for (i=0;i<TIMER_SLAB;i++) {
+			node = (struct timer_node *)(slab + i * TIMER_NODE_SIZE);
+			node->next = T->freelist;
+			T->freelist = node;
+		}
+		node = T->freelist;
+	}
+	T->freelist = node->next;
+	return node;
+}
+
 /**
  * @brief handle of  all time events
  * @param[in] timer handle
- * @param[in] arg arg for this event
- * @param[in] sz size of the arg
+ * @param[in] event timer event
  * @param[in] trigger time
  */
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-        /*alloc a node, as arg store after node*/
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);
-	/*copy arg*/
-	memcpy(node+1,arg,sz);
-
+timer_add(struct timer *T,struct timer_event *event,int time) {
 	LOCK(T);
+		struct timer_node *node = node_alloc(T);
+		*node_event(node) = *event;
+		node->cancel = 0;
                 /*update the expire time*/
 		node->expire=time+T->time;
 		/*add the node into timer handle*/
 		add_node(T,node);
+		if (++T->hash_count > T->hash_size * 2) {
+			hash_expand(T);
+		}
+		hash_insert(T,node);
 
 	UNLOCK(T);
 }
 
+/**
+ * @brief cancel a timer not expired
+ * @param[in] T timer handle
+ * @param[in] handle module id
+ * @param[in] session session of the timer
+ * @return 0 for success, 1 for not found (maybe expired and the message is pushed)
+ * @note the node is marked and recycled when it expires
+ */
+static int
+timer_cancel(struct timer *T, uint32_t handle, int session) {
+	int ret = 1;
+	LOCK(T);
+	struct timer_node *node = *hash_slot(T, handle, session);
+	while (node) {
+		struct timer_event *event = node_event(node);
+		if (event->handle == handle && event->session == session) {
+			hash_remove(node);
+			--T->hash_count;
+			node->cancel = 1;
+			ret = 0;
+			break;
+		}
+		node = node->hnext;
+	}
+	UNLOCK(T);
+	return ret;
+}
+
 static void
 move_list(struct timer *T, int level, int idx) {
 	struct timer_node *current = link_clear(&T->t[level][idx]);
@@ -174,22 +306,82 @@ timer_shift(struct timer *T) {
 	UNLOCK(T);
 }
 
+/**
+ * @brief remove the expired nodes from the index, so they can't be cancelled any more
+ * @note lock T before call it
+ */
 static inline void
-dispatch_list(struct timer_node *current) {
-	do {
-		struct timer_event * event = (struct timer_event *)(current+1);
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
-		message.data = NULL;
-		message.sz = PTYPE_RESPONSE << HANDLE_REMOTE_SHIFT;
+unhash_list(struct timer *T, struct timer_node *current) {
+	while (current) {
+		if (!current->cancel) {
+			hash_remove(current);
+			--T->hash_count;
+		}
+		current = current->next;
+	}
+}
 
-		skynet_context_push(event->handle, &message);
-		
-		struct timer_node * temp = current;
+static int
+compare_expire(const void *a, const void *b) {
+	const struct timer_expire *ea = a;
+	const struct timer_expire *eb = b;
+	if (ea->handle != eb->handle) {
+		return ea->handle < eb->handle ? -1 : 1;
+	}
+	return ea->seq - eb->seq;
+}
+
+/**
+ * @brief push the responses of the same handle with one lock of its queue
+ */
+static void
+dispatch_batch(struct timer_expire *e, int n) {
+	struct skynet_message message[TIMER_BATCH];
+	int i;
+	for (i=0;i<n;i++) {
+		message[i].source = 0;
+		message[i].session = e[i].session;
+		message[i].data = NULL;
+		message[i].sz = PTYPE_RESPONSE << HANDLE_REMOTE_SHIFT;
+	}
+	skynet_context_push_batch(e[0].handle, message, n);
+}
+
+/**
+ * @brief push the messages of expired (and not cancelled) nodes, grouped by handle
+ * @return the last node of the list
+ */
+static inline struct timer_node *
+dispatch_list(struct timer *T, struct timer_node *current) {
+	int n = 0;
+	for (;;) {
+		if (!current->cancel) {
+			if (n >= T->expire_cap) {
+				T->expire_cap = T->expire_cap ? T->expire_cap * 2 : TIMER_BATCH;
+				T->expire = skynet_realloc(T->expire, T->expire_cap * sizeof(struct timer_expire));
+			}
+			struct timer_event * event = node_event(current);
+			T->expire[n].handle = event->handle;
+			T->expire[n].session = event->session;
+			T->expire[n].seq = n;
+			++n;
+		}
+		if (current->next == NULL) {
+			break;
+		}
 		current=current->next;
-		skynet_free(temp);	
-	} while (current);
+	}
+	if (n > 1) {
+		qsort(T->expire, n, sizeof(struct timer_expire), compare_expire);
+	}
+	int i, start = 0;
+	for (i=1;i<=n;i++) {
+		if (i == n || T->expire[i].handle != T->expire[start].handle || i - start == TIMER_BATCH) {
+			dispatch_batch(&T->expire[start], i - start);
+			start = i;
+		}
+	}
+	return current;
 }
 
 static inline void
@@ -199,10 +391,14 @@ timer_execute(struct timer *T) {
 	
 	while (T->near[idx].head.next) {
 		struct timer_node *current = link_clear(&T->near[idx]);
+		unhash_list(T, current);
 		UNLOCK(T);
 		// dispatch_list don't need lock T
-		dispatch_list(current);
+		struct timer_node *last = dispatch_list(T, current);
 		LOCK(T);
+		// recycle the nodes into pool
+		last->next = T->freelist;
+		T->freelist = current;
 	}
 
 	UNLOCK(T);
@@ -239,13 +435,19 @@ timer_create_timer() {
 
 	r->lock = 0;
 	r->current = 0;
+	r->hash_size = TIMER_HASH_SIZE;
+	r->hash = skynet_malloc(r->hash_size * sizeof(struct timer_node *));
+	memset(r->hash, 0, r->hash_size * sizeof(struct timer_node *));
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
-	if (time == 0) {
+/**
+ * @brief add a timer trigger after ticks, push the response directly when ticks is 0
+ */
+static int
+timeout_ticks(uint32_t handle, uint32_t ticks, int session) {
+	if (ticks == 0) {
 		struct skynet_message message;
 		message.source = 0;
 		/*set session id*/
@@ -264,12 +466,44 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		/*set session*/
 		event.session = session;
 		/*add this event to timer list, trigger after time*/
-		timer_add(TI, &event, sizeof(event), time);
+		timer_add(TI, &event, ticks);
 	}
 
 	return session;
 }
 
+/**
+ * @brief register a timer of centiseconds
+ * @param[in] handle module id
+ * @param[in] time centiseconds
+ * @param[in] session session of the response
+ */
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	return timeout_ticks(handle, (uint32_t)time * TI->scale, session);
+}
+
+/**
+ * @brief register a timer of milliseconds
+ * @note rounded up to the timer resolution, so it never triggers earlier
+ */
+int
+skynet_timeout_ms(uint32_t handle, int ms, int session) {
+	uint32_t ticks = (uint32_t)(((uint64_t)ms * TI->resolution + 999) / 1000);
+	return timeout_ticks(handle, ticks, session);
+}
+
+/**
+ * @brief cancel the timer of session, the message will not be pushed
+ * @param[in] handle module id
+ * @param[in] session session returned by skynet_timeout
+ * @return 0 for success, 1 if the timer is not found (expired already)
+ */
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	return timer_cancel(TI, handle, session);
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
@@ -286,8 +520,9 @@ systime(uint32_t *sec, uint32_t *cs) {
 #endif
 }
 
+// monotonic nanosecond
 static uint64_t
-gettime() {
+gettime_ns() {
 	uint64_t t;
 #if !defined(__APPLE__)
 
@@ -299,17 +534,23 @@ gettime() {
 
 	struct timespec ti;
 	clock_gettime(CLOCK_TIMER, &ti);
-	t = (uint64_t)ti.tv_sec * 100;
-	t += ti.tv_nsec / 10000000;
+	t = (uint64_t)ti.tv_sec * 1000000000;
+	t += ti.tv_nsec;
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
+	t = (uint64_t)tv.tv_sec * 1000000000;
+	t += (uint64_t)tv.tv_usec * 1000;
 #endif
 	return t;
 }
 
+// ticks of timer resolution
+static uint64_t
+gettime() {
+	return gettime_ns() / (1000000000 / TI->resolution);
+}
+
 void
 skynet_updatetime(void) {
 	uint64_t cp = gettime();
@@ -318,10 +559,12 @@ skynet_updatetime(void) {
 		TI->current_point = cp;
 	} else if (cp != TI->current_point) {
 		uint32_t diff = (uint32_t)(cp - TI->current_point);
+		// TI->current is always centisecond
+		uint32_t cs = (uint32_t)(cp / TI->scale - TI->current_point / TI->scale);
 		TI->current_point = cp;
 
 		uint32_t oc = TI->current;
-		TI->current += diff;
+		TI->current += cs;
 		if (TI->current < oc) {
 			// when cs > 0xffffffff(about 497 days), time rewind
 			TI->starttime += 0xffffffff / 100;
@@ -343,9 +586,39 @@ skynet_gettime(void) {
 	return TI->current;
 }
 
+/**
+ * @brief milliseconds since the timer start, read from the clock directly
+ */
+uint32_t
+skynet_gettime_ms(void) {
+	return (uint32_t)(gettime_ns() / 1000000 - TI->origin_point * 1000 / TI->resolution);
+}
+
+/**
+ * @brief microseconds to the next tick, rounded up so the tick has begun when it's reached
+ */
+int
+skynet_timer_next(void) {
+	uint64_t tick = 1000000000 / TI->resolution;
+	uint64_t ns = tick - gettime_ns() % tick;
+	return (int)((ns + 999) / 1000);
+}
+
+/**
+ * @brief init the timer
+ * @param[in] resolution ticks per second, 100 (centisecond) or a multiple of 100 divides 1000, 0 for default
+ */
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int resolution) {
 	TI = timer_create_timer();
+	if (resolution == 0) {
+		resolution = TIMER_RESOLUTION;
+	} else if (resolution % 100 != 0 || 1000 % resolution != 0) {
+		skynet_error(NULL, "Invalid timer resolution %d, use %d", resolution, TIMER_RESOLUTION);
+		resolution = TIMER_RESOLUTION;
+	}
+	TI->resolution = resolution;
+	TI->scale = resolution / 100;
 	systime(&TI->starttime, &TI->current);
 	uint64_t point = gettime();
 	TI->current_point = point;
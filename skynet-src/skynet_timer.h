@@ -4,10 +4,14 @@
 #include <stdint.h>
 
 int skynet_timeout(uint32_t handle, int time, int session);
+int skynet_timeout_ms(uint32_t handle, int ms, int session);
+int skynet_timeout_cancel(uint32_t handle, int session);
 void skynet_updatetime(void);
 uint32_t skynet_gettime(void);
 uint32_t skynet_gettime_fixsec(void);
+uint32_t skynet_gettime_ms(void);
+int skynet_timer_next(void);
 
-void skynet_timer_init(void);
+void skynet_timer_init(int resolution);
 
 #endif
@@ -0,0 +1,217 @@
+/**
+ * @file socket_buffer.c
+ * @brief size classed receive buffers of the socket threads
+ * @note every socket thread owns a pool, blocks are carved from slabs and
+ *       returned to the pool they come from by any thread
+ */
+#include "skynet.h"
+
+#include "socket_buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BUFFER_SIZE 64          /*payload size of the smallest class*/
+#define BUFFER_CLASS 11             /*payload size of class n is MIN_BUFFER_SIZE << n, up to 64K*/
+#define SLAB_SIZE (64 * 1024)       /*a slab holds blocks of one class*/
+
+struct buffer_pool;
+
+/**
+ * @brief head of a buffer, the payload follows it
+ */
+struct buffer_block {
+	struct buffer_block * next; /*link in the free list*/
+	struct buffer_pool * pool;  /*pool it belongs to*/
+	int sclass;                 /*size class, -1 for the large buffer malloc directly*/
+	int size;                   /*payload size*/
+	union {
+		char header[SOCKET_BUFFER_HEADER];
+		void * align;
+	} u;                        /*room of the message header*/
+};
+
+/**
+ * @brief slabs are never freed until the pools release
+ */
+struct buffer_slab {
+	struct buffer_slab * next;
+};
+
+/**
+ * @brief free blocks of one size class
+ */
+struct buffer_class {
+	struct buffer_block * free;     /*only the owner thread use it*/
+	struct buffer_block * freed;    /*pushed by any thread, the owner takes all of them at once*/
+};
+
+/**
+ * @brief pool of one socket thread
+ */
+struct buffer_pool {
+	struct buffer_class c[BUFFER_CLASS];
+	struct buffer_slab * slab;  /*all slabs of this pool*/
+	uint64_t alloc;             /*only the owner thread changes the counters except inflight*/
+	uint64_t hit;
+	int64_t slab_size;
+	int64_t inflight;
+	char pad[64];               /*pools of the socket threads are not in the same cache line*/
+};
+
+static struct buffer_pool * POOL = NULL;
+static int NPOOL = 0;
+
+/**
+ * @brief init the pools
+ * @param[in] npool one pool for each socket thread
+ */
+void
+socket_buffer_init(int npool) {
+	assert(npool > 0);
+	POOL = skynet_malloc(npool * sizeof(struct buffer_pool));
+	memset(POOL, 0, npool * sizeof(struct buffer_pool));
+	NPOOL = npool;
+}
+
+/**
+ * @brief free all the slabs, the buffers in flight are invalid after it
+ */
+void
+socket_buffer_release(void) {
+	int i;
+	for (i=0;i<NPOOL;i++) {
+		struct buffer_slab *s = POOL[i].slab;
+		while (s) {
+			struct buffer_slab *next = s->next;
+			skynet_free(s);
+			s = next;
+		}
+	}
+	skynet_free(POOL);
+	POOL = NULL;
+	NPOOL = 0;
+}
+
+/**
+ * @brief the smallest class can hold sz, -1 if sz is too large
+ */
+static inline int
+size_class(int sz) {
+	int sclass = 0;
+	int size = MIN_BUFFER_SIZE;
+	while (size < sz) {
+		if (++sclass >= BUFFER_CLASS) {
+			return -1;
+		}
+		size <<= 1;
+	}
+	return sclass;
+}
+
+/**
+ * @brief alloc a slab and carve it into blocks
+ * @return the list of the blocks
+ */
+static struct buffer_block *
+new_slab(struct buffer_pool *p, int sclass) {
+	int size = MIN_BUFFER_SIZE << sclass;
+	int bsz = sizeof(struct buffer_block) + size;
+	int n = SLAB_SIZE / bsz;
+	if (n < 1) {
+		n = 1;
+	}
+	struct buffer_slab * slab = skynet_malloc(sizeof(struct buffer_slab) + (size_t)n * bsz);
+	slab->next = p->slab;
+	p->slab = slab;
+	p->slab_size += n * bsz;
+
+	char * ptr = (char *)(slab + 1);
+	struct buffer_block * head = NULL;
+	int i;
+	for (i=n-1;i>=0;i--) {
+		struct buffer_block * b = (struct buffer_block *)(ptr + i * bsz);
+		b->next = head;
+		b->pool = p;
+		b->sclass = sclass;
+		b->size = size;
+		head = b;
+	}
+	return head;
+}
+
+/**
+ * @brief alloc a buffer
+ * @param[in] pool index of the pool, the socket thread calls it owns the pool
+ * @param[in] sz payload size
+ * @return payload, SOCKET_BUFFER_HEADER bytes before it can be used by the caller
+ */
+void *
+socket_buffer_alloc(int pool, int sz) {
+	assert(pool >= 0 && pool < NPOOL);
+	struct buffer_pool *p = &POOL[pool];
+	struct buffer_block *b;
+	int sclass = size_class(sz);
+	++p->alloc;
+	if (sclass < 0) {
+		b = skynet_malloc(sizeof(struct buffer_block) + sz);
+		b->pool = p;
+		b->sclass = -1;
+		b->size = sz;
+	} else {
+		struct buffer_class *c = &p->c[sclass];
+		b = c->free;
+		if (b == NULL) {
+			b = __sync_lock_test_and_set(&c->freed, NULL);
+		}
+		if (b) {
+			++p->hit;
+		} else {
+			b = new_slab(p, sclass);
+		}
+		c->free = b->next;
+	}
+	__sync_add_and_fetch(&p->inflight, b->size);
+	return b + 1;
+}
+
+/**
+ * @brief return the buffer to its pool
+ * @param[in] buffer payload returned by socket_buffer_alloc
+ */
+void
+socket_buffer_free(void * buffer) {
+	if (buffer == NULL) {
+		return;
+	}
+	struct buffer_block *b = (struct buffer_block *)buffer - 1;
+	struct buffer_pool *p = b->pool;
+	__sync_sub_and_fetch(&p->inflight, b->size);
+	if (b->sclass < 0) {
+		skynet_free(b);
+		return;
+	}
+	struct buffer_class *c = &p->c[b->sclass];
+	struct buffer_block *head;
+	do {
+		head = c->freed;
+		b->next = head;
+	} while (!__sync_bool_compare_and_swap(&c->freed, head, b));
+}
+
+/**
+ * @brief sum the counters of all pools
+ */
+void
+socket_buffer_stat(struct socket_buffer_stat *stat) {
+	int i;
+	memset(stat, 0, sizeof(*stat));
+	for (i=0;i<NPOOL;i++) {
+		struct buffer_pool *p = &POOL[i];
+		stat->alloc += p->alloc;
+		stat->hit += p->hit;
+		stat->inflight += p->inflight;
+		stat->slab += p->slab_size;
+	}
+}
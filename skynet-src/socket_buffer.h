@@ -0,0 +1,26 @@
+#ifndef skynet_socket_buffer_h
+#define skynet_socket_buffer_h
+
+#include <stdint.h>
+
+// room before the payload, the socket message header is stored in it (see forward_message in skynet_socket.c)
+#define SOCKET_BUFFER_HEADER 32
+
+/**
+ * @brief counters of the receive buffer pools, read by STAT command
+ */
+struct socket_buffer_stat {
+	uint64_t alloc;         /*tot buffers alloc*/
+	uint64_t hit;           /*buffers reused from the pool*/
+	int64_t inflight;       /*bytes of the buffers not freed yet*/
+	int64_t slab;           /*bytes of the slabs hold by the pools*/
+};
+
+void socket_buffer_init(int npool);
+void socket_buffer_release(void);
+// only the socket thread owns the pool can alloc from it, free can be called by any thread
+void * socket_buffer_alloc(int pool, int sz);
+void socket_buffer_free(void * buffer);
+void socket_buffer_stat(struct socket_buffer_stat *stat);
+
+#endif
@@ -0,0 +1,396 @@
+/**
+ * @file socket_iouring.h
+ * @brief wrap of io_uring api, used instead of epoll when build with -DSOCKET_IOURING
+ * @note every socket has a oneshot poll request in the ring, it is armed again after its
+ *       event is reported, so the events are level triggered like epoll.
+ *       sp_add, sp_write and sp_del only queue the requests, they are submitted by the
+ *       io_uring_enter of next sp_wait, which reaps the completions too.
+ *
+ */
+#ifndef poll_socket_iouring_h
+#define poll_socket_iouring_h
+
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 1024          /*size of submission queue*/
+#define URING_CQ_ENTRIES 16384      /*size of completion queue, more than the sockets in flight usually*/
+#define URING_REMOVE (~(uint64_t)0) /*user data of the poll remove requests, their completions are ignored*/
+
+/**
+ * @brief poll state of a socket fd
+ */
+struct sp_fd {
+	void * ud;          /*private data for event*/
+	uint32_t gen;       /*changed when the poll request is replaced, completions of the old one are ignored*/
+	uint16_t mask;      /*POLLIN, and POLLOUT if write enabled*/
+	uint8_t used;       /*added and not deleted*/
+	uint8_t armed;      /*poll request in the ring*/
+};
+
+/**
+ * @brief the rings shared with the kernel
+ */
+struct sp_uring {
+	int fd;                         /*io_uring fd*/
+	unsigned entries;               /*size of submission queue*/
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;                   /*mmap of the rings*/
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+	struct sp_fd *fds;              /*indexed by socket fd*/
+	int nfds;
+	int *rearm;                     /*fds reported by last wait, arm them again*/
+	int nrearm;
+	int cap_rearm;
+};
+
+static inline int
+uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+/**
+ * @brief check if the handle is valid
+ * @param[in] p handle of io_uring
+ * @return valid ? false : true
+ */
+static bool
+sp_invalid(struct sp_uring *p) {
+	return p == NULL;
+}
+
+/**
+ * @brief close the handle of the io_uring
+ */
+static void
+sp_release(struct sp_uring *p) {
+	if (p->sqes) {
+		munmap(p->sqes, p->sqes_size);
+	}
+	if (p->cq_ptr && p->cq_ptr != p->sq_ptr) {
+		munmap(p->cq_ptr, p->cq_size);
+	}
+	if (p->sq_ptr) {
+		munmap(p->sq_ptr, p->sq_size);
+	}
+	close(p->fd);
+	free(p->fds);
+	free(p->rearm);
+	free(p);
+}
+
+/**
+ * @brief create the io_uring and map its rings
+ * @return the handle of io_uring, NULL if failed
+ */
+static struct sp_uring *
+sp_create() {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+	int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct sp_uring *p = malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	p->fd = fd;
+	p->entries = params.sq_entries;
+	p->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	p->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (p->cq_size > p->sq_size) {
+			p->sq_size = p->cq_size;
+		}
+		p->cq_size = p->sq_size;
+	}
+	p->sq_ptr = mmap(NULL, p->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (p->sq_ptr == MAP_FAILED) {
+		p->sq_ptr = NULL;
+		sp_release(p);
+		return NULL;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		p->cq_ptr = p->sq_ptr;
+	} else {
+		p->cq_ptr = mmap(NULL, p->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (p->cq_ptr == MAP_FAILED) {
+			p->cq_ptr = NULL;
+			sp_release(p);
+			return NULL;
+		}
+	}
+	p->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	p->sqes = mmap(NULL, p->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (p->sqes == MAP_FAILED) {
+		p->sqes = NULL;
+		sp_release(p);
+		return NULL;
+	}
+	char *sq = p->sq_ptr;
+	p->sq_head = (unsigned *)(sq + params.sq_off.head);
+	p->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	p->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	p->sq_array = (unsigned *)(sq + params.sq_off.array);
+	char *cq = p->cq_ptr;
+	p->cq_head = (unsigned *)(cq + params.cq_off.head);
+	p->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	p->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	p->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return p;
+}
+
+/**
+ * @brief get a free submission entry, submit the queued ones if the queue is full
+ */
+static struct io_uring_sqe *
+uring_sqe(struct sp_uring *p) {
+	unsigned tail = *p->sq_tail;
+	while (tail - __atomic_load_n(p->sq_head, __ATOMIC_ACQUIRE) >= p->entries) {
+		if (uring_enter(p->fd, tail - *p->sq_head, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return NULL;
+		}
+	}
+	unsigned idx = tail & *p->sq_mask;
+	struct io_uring_sqe *sqe = &p->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	p->sq_array[idx] = idx;
+	return sqe;
+}
+
+/**
+ * @brief publish the entry got by uring_sqe
+ */
+static inline void
+uring_push(struct sp_uring *p) {
+	__atomic_store_n(p->sq_tail, *p->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief get the poll state of the fd, grow the table if need
+ */
+static struct sp_fd *
+uring_fd(struct sp_uring *p, int sock) {
+	if (sock >= p->nfds) {
+		int n = p->nfds ? p->nfds : 1024;
+		while (n <= sock) {
+			n *= 2;
+		}
+		p->fds = realloc(p->fds, n * sizeof(struct sp_fd));
+		memset(p->fds + p->nfds, 0, (n - p->nfds) * sizeof(struct sp_fd));
+		p->nfds = n;
+	}
+	return &p->fds[sock];
+}
+
+/**
+ * @brief queue a oneshot poll request of the fd
+ */
+static void
+uring_arm(struct sp_uring *p, int sock) {
+	struct sp_fd *f = &p->fds[sock];
+	struct io_uring_sqe *sqe = uring_sqe(p);
+	if (sqe == NULL) {
+		return;
+	}
+	++f->gen;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sock;
+	sqe->poll32_events = f->mask;
+	sqe->user_data = (uint64_t)f->gen << 32 | (uint32_t)sock;
+	uring_push(p);
+	f->armed = 1;
+}
+
+/**
+ * @brief queue a request to remove the poll request of the fd
+ */
+static void
+uring_disarm(struct sp_uring *p, int sock) {
+	struct sp_fd *f = &p->fds[sock];
+	if (!f->armed) {
+		return;
+	}
+	struct io_uring_sqe *sqe = uring_sqe(p);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)f->gen << 32 | (uint32_t)sock;
+	sqe->user_data = URING_REMOVE;
+	uring_push(p);
+	f->armed = 0;
+}
+
+/**
+ * @brief register a read event
+ * @param[in] p handle of io_uring
+ * @param[in] sock fd of socket
+ * @param[in] ud private data for event
+ */
+static int
+sp_add(struct sp_uring *p, int sock, void *ud) {
+	struct sp_fd *f = uring_fd(p, sock);
+	f->ud = ud;
+	f->mask = POLLIN;
+	f->used = 1;
+	f->armed = 0;
+	uring_arm(p, sock);
+	return 0;
+}
+
+/**
+ * @brief delete the event of the fd
+ * @param[in] p handle of io_uring
+ * @param[in] sock socket registered
+ *
+ */
+static void
+sp_del(struct sp_uring *p, int sock) {
+	if (sock < 0 || sock >= p->nfds) {
+		return;
+	}
+	struct sp_fd *f = &p->fds[sock];
+	uring_disarm(p, sock);
+	f->used = 0;
+	f->ud = NULL;
+	// ignore the completion of the request removed
+	++f->gen;
+}
+
+/**
+ * @brief register event of write
+ * @param[in]  p handle of io_uring
+ * @param[in]  ud private data
+ * @param[in]  enable enable the write ?
+ *
+ */
+static void
+sp_write(struct sp_uring *p, int sock, void *ud, bool enable) {
+	if (sock < 0 || sock >= p->nfds) {
+		return;
+	}
+	struct sp_fd *f = &p->fds[sock];
+	uint16_t mask = POLLIN | (enable ? POLLOUT : 0);
+	f->ud = ud;
+	if (f->mask == mask) {
+		return;
+	}
+	f->mask = mask;
+	if (f->armed) {
+		// replace the request in flight, or it is armed with the new mask after reported
+		uring_disarm(p, sock);
+		uring_arm(p, sock);
+	}
+}
+
+/**
+ * @brief submit the requests queued, wait the completions and mark all evnets occured
+ * @param[in] p handle of io_uring
+ * @param[in] e get the evnet actived
+ * @param[in] max max event could hold
+ * @return tot event actived, -1 for error
+ *
+ */
+static int
+sp_wait(struct sp_uring *p, struct event *e, int max) {
+	int i;
+	for (i=0;i<p->nrearm;i++) {
+		int sock = p->rearm[i];
+		struct sp_fd *f = &p->fds[sock];
+		if (f->used && !f->armed) {
+			uring_arm(p, sock);
+		}
+	}
+	p->nrearm = 0;
+	for (;;) {
+		unsigned head = *p->cq_head;
+		unsigned tail = __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE);
+		unsigned submit = *p->sq_tail - __atomic_load_n(p->sq_head, __ATOMIC_ACQUIRE);
+		if (submit > 0 || head == tail) {
+			bool wait = (head == tail);
+			if (uring_enter(p->fd, submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0) < 0 && wait) {
+				return -1;
+			}
+			tail = __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE);
+		}
+		int n = 0;
+		while (head != tail && n < max) {
+			struct io_uring_cqe *cqe = &p->cqes[head & *p->cq_mask];
+			++head;
+			if (cqe->user_data == URING_REMOVE) {
+				continue;
+			}
+			int sock = (int)(uint32_t)cqe->user_data;
+			uint32_t gen = (uint32_t)(cqe->user_data >> 32);
+			if (sock >= p->nfds) {
+				continue;
+			}
+			struct sp_fd *f = &p->fds[sock];
+			if (!f->used || f->gen != gen) {
+				// removed or replaced
+				continue;
+			}
+			f->armed = 0;
+			if (p->nrearm >= p->cap_rearm) {
+				p->cap_rearm = p->cap_rearm ? p->cap_rearm * 2 : 64;
+				p->rearm = realloc(p->rearm, p->cap_rearm * sizeof(int));
+			}
+			p->rearm[p->nrearm++] = sock;
+			// the poll request failed, report it as readable, the read gets the error of the socket,
+			// or EAGAIN and the fd is armed again
+			unsigned flag = cqe->res < 0 ? POLLERR : (unsigned)cqe->res;
+			e[n].s = f->ud;
+			e[n].write = (flag & POLLOUT) != 0;
+			e[n].read = (flag & (POLLIN | POLLERR | POLLHUP)) != 0;
+			++n;
+		}
+		__atomic_store_n(p->cq_head, head, __ATOMIC_RELEASE);
+		if (n > 0) {
+			return n;
+		}
+	}
+}
+
+/**
+ * @brief set the fd in nonblock
+ * @param[in] fd fd of the socket
+ *
+ */
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
@@ -3,7 +3,12 @@
 
 #include <stdbool.h>
 
+#if defined(__linux__) && defined(SOCKET_IOURING)
+// make with MYCFLAGS=-DSOCKET_IOURING to use io_uring instead of epoll
+typedef struct sp_uring * poll_fd;
+#else
 typedef int poll_fd;
+#endif
 
 /**
  * @brief used to record what happended
@@ -24,8 +29,12 @@ static int sp_wait(poll_fd, struct event *e, int max);
 static void sp_nonblocking(int sock);
 
 #ifdef __linux__
+#ifdef SOCKET_IOURING
+#include "socket_iouring.h"
+#else
 #include "socket_epoll.h"
 #endif
+#endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #include "socket_kqueue.h"
@@ -6,13 +6,19 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                 /*recvmmsg and sendmmsg*/
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
 #include "socket_poll.h"
+#include "socket_buffer.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -22,11 +28,18 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16             /*max socket will be 2^MAX_SOCKET_P*/  
-#define MAX_EVENT 64                /*max event can hold*/
+#define MAX_SOCKET_P 16             /*default max socket of a socket thread will be 2^MAX_SOCKET_P*/  
+#define SLOT_PAGE_P 10              /*the slot table grows by 2^SLOT_PAGE_P slots*/
+#define MAX_EVENT 64                /*default max events of one wait*/
 #define MIN_READ_BUFFER 64          /*origin read buffer for tcp*/
 #define SOCKET_TYPE_INVALID 0       /*invalid flag*/
 #define SOCKET_TYPE_RESERVE 1       /*socket empty*/
@@ -38,13 +51,14 @@
 #define SOCKET_TYPE_PACCEPT 7       /*others connect to skynet success*/
 #define SOCKET_TYPE_BIND 8          /*bind the address*/
 
-#define MAX_SOCKET (1<<MAX_SOCKET_P)/*max socket*/ 
+#define MAX_SOCKET (1<<MAX_SOCKET_P)/*default max socket*/ 
+#define SLOT_PAGE (1<<SLOT_PAGE_P)  /*slots of one page*/
 
 #define PRIORITY_HIGH 0             /*high write buffer list*/
 #define PRIORITY_LOW 1              /*low write buffer list*/
 
-/*hash function*/
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET) /*convert id to socket slot's index*/
+/*hash function, id % nshard is the shard the socket belongs to*/
+#define HASH_ID(ss, id) ((((unsigned)id) / (ss)->nshard) & ((ss)->max_slot - 1)) /*convert id to socket slot's index*/
 
 #define PROTOCOL_TCP 0              /*tcp*/
 #define PROTOCOL_UDP 1              /*udp*/
@@ -54,6 +68,21 @@
 
 #define MAX_UDP_PACKAGE 65535       /*max payload for udp*/
 
+#if defined(__linux__)
+#define UDP_BATCH 16                /*max datagrams of one recvmmsg or sendmmsg*/
+#else
+#define UDP_BATCH 1
+#endif
+#define UDP_FLUSH 64                /*max udp sockets wait for flush, and max commands handled before flush*/
+
+#define CTRL_RING_SIZE 1024         /*ctrl commands wait for socket thread, power of 2*/
+
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define MAX_IOV IOV_MAX             /*max buffers gather in one writev*/
+#else
+#define MAX_IOV 1024
+#endif
+
 /**
  * @brief buffer wait to write
  */
@@ -86,8 +115,16 @@ struct socket {
 	struct wb_list high;/*high rate write buffer list*/    
 	struct wb_list low; /*low  rate write buffer list*/
 	int64_t wb_size;    /*tot size of the payload wait to send*/
+	int64_t warn_high;  /*report SOCKET_WARNING when wb_size reaches it, 0 for never*/
+	int64_t warn_low;   /*report SOCKET_WARNING again when wb_size falls to it*/
+	int warn;           /*wb_size is above warn_high, wait for falling to warn_low*/
+	int sending;        /*send requests of the slot in ctrl ring, not handled by socket thread*/
+	int direct_rest;    /*the rest of a direct write is in ctrl ring, see direct_write*/
+	int lock;           /*hold by the worker writing fd directly, or socket thread closing fd*/
 	int fd;             /*socket fd*/
 	int id;             /*id alloc for this socket*/ 
+	int group;          /*id of the first listen socket of a SO_REUSEPORT group, -1 for others*/
+	struct socket * next; /*link in the free list*/
 	uint16_t protocol;  /*link protocol*/
 	uint16_t type;      /*status of the socket*/
 	union {
@@ -96,23 +133,55 @@ struct socket {
 	} p;
 };
 
+/**
+ * @brief ctrl command in ring, seq is the position it can be written (or pos+1 for read)
+ */
+struct ctrl_entry {
+	unsigned seq;
+	uint8_t type;
+	uint8_t len;
+	union {
+		char buffer[256];
+		void * align;
+	} u;
+};
+
 /**
  * @brief manager of all socket thread
  */
 struct socket_server {
-	int recvctrl_fd;    /*read fd of pipe*/
-	int sendctrl_fd;    /*send fd of pipe*/
-	int checkctrl;      /*mark if check the ctrl msg from pipe*/ 
+	int recvctrl_fd;    /*read fd of wakeup (eventfd, or pipe)*/
+	int sendctrl_fd;    /*send fd of wakeup*/
+	int ctrl_wait;      /*socket thread is going to wait, wakeup it after push ctrl command*/
+	unsigned ctrl_head; /*read position of ctrl ring, only socket thread use it*/
+	unsigned ctrl_tail; /*write position of ctrl ring*/
+	struct ctrl_entry ctrl[CTRL_RING_SIZE]; /*mpsc ring of ctrl commands*/
 	poll_fd event_fd;   /*epoll handle*/
-	int alloc_id;       /*curr id alloc for socket, socket_id = HASH_ID(alloc_id < 0 ? alloc + 0x7fffffff, alloc_id)*/
+	int shard;          /*index of this socket server, ids alloc here are shard + n * nshard*/
+	int nshard;         /*tot socket servers (socket threads)*/
+	int alloc_mask;     /*n of the ids is masked to keep the ids positive*/
+	int free_lock;      /*spin lock of the free list, ids are reserved by any thread*/
+	struct socket * free_head; /*free slots, reserved from the head and returned to the tail*/
+	struct socket * free_tail;
+	int max_slot;       /*max slots, power of 2*/
+	int npage;          /*pages alloc, slots are never moved after alloc*/
+	struct socket ** page; /*max_slot / SLOT_PAGE pages*/
+	struct socket invalid; /*returned for the ids out of the pages alloc*/
+	unsigned next_peer; /*round robin counter, which shard the accepted socket is handed to*/
+	struct socket_server ** peer; /*all socket servers, indexed by shard*/
 	int event_n;        /*tot event occured*/
 	int event_index;    /*idx of the event need to solve*/
+	int max_accept;     /*max connections accepted for one readiness of the listen socket*/
+	int accept_n;       /*connections accepted for the current readiness*/
+	bool rawaddr;       /*report the peer address of accepted socket in udp address format, see socket_server_accept*/
 	struct socket_object_interface soi; /*used when need ctrl payload by user api*/
-	struct event ev[MAX_EVENT];         /*used to get event when call epoll*/
-	struct socket slot[MAX_SOCKET];     /*store all the socket*/
+	int max_event;                      /*size of ev*/
+	struct event *ev;                   /*used to get event when call epoll*/
 	char buffer[MAX_INFO];
-	uint8_t udpbuffer[MAX_UDP_PACKAGE]; /*buffer used to recive udp msg*/
-	fd_set rfds;                        /*fd group*/
+	struct udp_batch * udp;             /*datagrams received by one recvmmsg, alloc when first used*/
+	int udp_flush_n;                    /*udp sockets have datagrams appended but not sent yet*/
+	int udp_flush_cmd;                  /*commands handled since the first one appended*/
+	int udp_flush[UDP_FLUSH];           /*ids of these udp sockets*/
 };
 
 /**
@@ -131,6 +200,7 @@ struct request_open {
 struct request_send {
 	int id;                 /*id of the socket*/
 	int sz;                 /*data size*/
+	int offset;             /*size written by the worker directly*/
 	char * buffer;          /*payload ptr*/
 };
 
@@ -166,6 +236,7 @@ struct request_close {
 struct request_listen {
 	int id;                                 /*id of the socket*/
 	int fd;                                 /*listem fd*/
+	int group;                              /*id of the first listen socket of the SO_REUSEPORT group, or -1*/
 	uintptr_t opaque;                       /*id of the module socket belong to*/
 	char host[1];                           /*TODO not used???*/
 };
@@ -179,6 +250,15 @@ struct request_bind {
 	uintptr_t opaque;                       /*id of the  module socket belong to*/
 };
 
+/**
+ * @brief request to take over a socket accepted by other shard
+ */
+struct request_accept {
+	int id;                                 /*id reserved in this shard*/
+	int fd;                                 /*accepted fd*/
+	uintptr_t opaque;                       /*id of the module the listen socket belong to*/
+};
+
 /**
  * @brief request socket start
  */
@@ -196,6 +276,15 @@ struct request_setopt {
 	int value;                              /*val for set key= val*/
 };
 
+/**
+ * @brief request to set the watermarks of the write buffer
+ */
+struct request_watermark {
+	int id;                                 /*id of the socket*/
+	int64_t high;                           /*high watermark, 0 for disable*/
+	int64_t low;                            /*low watermark*/
+};
+
 /**
  * @brief to init udp socket
  */
@@ -207,7 +296,7 @@ struct request_udp {
 };
 
 /*
-	The first byte is TYPE
+	The type of ctrl command (struct ctrl_entry), the request is copied from u
 
 	S Start socket
 	B Bind socket
@@ -221,9 +310,9 @@ struct request_udp {
 	T Set opt
 	U Create UDP socket
 	C set udp address
+	F Take over an accepted fd from other shard
  */
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;               
@@ -234,8 +323,10 @@ struct request_package {
 		struct request_bind bind;
 		struct request_start start;
 		struct request_setopt setopt;
+		struct request_watermark watermark;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_accept accept;
 	} u;
 	uint8_t dummy[256];
 };
@@ -250,6 +341,23 @@ union sockaddr_all {
 	struct sockaddr_in6 v6;     /*ipv6 storage*/
 };
 
+/**
+ * @brief datagrams received from one udp socket, handed to the module one by one
+ */
+struct udp_batch {
+	int id;                                 /*socket the pending datagrams come from*/
+	int n;                                  /*tot datagrams received*/
+	int index;                              /*idx of the next datagram to forward*/
+	int sz[UDP_BATCH];                      /*payload size*/
+	socklen_t addrsz[UDP_BATCH];            /*size of the peer address*/
+	union sockaddr_all addr[UDP_BATCH];     /*peer address*/
+#if defined(__linux__)
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+#endif
+	uint8_t buffer[UDP_BATCH][MAX_UDP_PACKAGE];
+};
+
 /**
  * @brief warp of obj wait to send
  */
@@ -262,6 +370,12 @@ struct send_object {
 #define MALLOC skynet_malloc
 #define FREE skynet_free
 
+static int push_request(struct socket_server *ss, struct request_package *request, char type, int len, bool wait);
+static inline int has_cmd(struct socket_server *ss);
+
+#define SOCKET_LOCK(s) while (__sync_lock_test_and_set(&(s)->lock,1)) {}
+#define SOCKET_UNLOCK(s) __sync_lock_release(&(s)->lock);
+
 /**
  * @brief convert oject to send_object
  * @param[in] ss socket manager
@@ -311,36 +425,108 @@ socket_keepalive(int fd) {
 	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));  
 }
 
+/**
+ * @brief get the slot of the id
+ * @return the slot, it's invalid if the id is not in use
+ */
+static inline struct socket *
+get_socket(struct socket_server *ss, int id) {
+	unsigned idx = HASH_ID(ss, id);
+	struct socket * page = ss->page[idx >> SLOT_PAGE_P];
+	if (page == NULL) {
+		return &ss->invalid;
+	}
+	return &page[idx & (SLOT_PAGE - 1)];
+}
+
+/**
+ * @brief alloc a page of slots and put them into the free list, hold the free_lock when call it
+ * @return false when the slots reach the max
+ */
+static bool
+new_page(struct socket_server *ss) {
+	int i;
+	if (ss->npage >= ss->max_slot / SLOT_PAGE) {
+		return false;
+	}
+	struct socket * page = MALLOC(SLOT_PAGE * sizeof(struct socket));
+	memset(page, 0, SLOT_PAGE * sizeof(struct socket));
+	for (i=0;i<SLOT_PAGE;i++) {
+		struct socket *s = &page[i];
+		s->type = SOCKET_TYPE_INVALID;
+		// the id last used, the first id reserved is the next round of it
+		s->id = (ss->npage * SLOT_PAGE + i) * ss->nshard + ss->shard;
+		s->next = (i == SLOT_PAGE - 1) ? NULL : &page[i+1];
+	}
+	if (ss->free_tail) {
+		ss->free_tail->next = page;
+	} else {
+		ss->free_head = page;
+	}
+	ss->free_tail = &page[SLOT_PAGE - 1];
+	// the worker threads may read the page after it is published
+	__sync_synchronize();
+	ss->page[ss->npage++] = page;
+	return true;
+}
+
+/**
+ * @brief append the slot to the free list, it is reused after the other free slots
+ */
+static void
+push_free(struct socket_server *ss, struct socket *s) {
+	s->next = NULL;
+	while (__sync_lock_test_and_set(&ss->free_lock,1)) {}
+	if (ss->free_tail) {
+		ss->free_tail->next = s;
+	} else {
+		ss->free_head = s;
+	}
+	ss->free_tail = s;
+	__sync_lock_release(&ss->free_lock);
+}
+
+/**
+ * @brief give back the slot reserved (or failed to open), do nothing if it's invalid already
+ */
+static void
+free_slot(struct socket_server *ss, struct socket *s) {
+	if (s->type != SOCKET_TYPE_INVALID) {
+		s->type = SOCKET_TYPE_INVALID;
+		push_free(ss, s);
+	}
+}
+
 /**
  * @brief get id by socket_server
- * @return id for the socket
+ * @return id for the socket, -1 if the slots reach the max
+ * @note the slot is taken from the free list, the id is the next round of the id used by the slot last time
  *
  */
 static int
 reserve_id(struct socket_server *ss) {
-	int i;
-	/*lookup all socket*/
-	for (i=0;i<MAX_SOCKET;i++) {
-	        /*here is will alloc as 1 ,2, 3, INT_MAX, INT_MAX - 1 ... 3 2 1*/
-		int id = __sync_add_and_fetch(&(ss->alloc_id), 1);
-		if (id < 0) {
-			id = __sync_and_and_fetch(&(ss->alloc_id), 0x7fffffff);
-		}
-		/*lookup slot by hash*/
-		struct socket *s = &ss->slot[HASH_ID(id)];
-		/*try to get the empty slots*/
-		if (s->type == SOCKET_TYPE_INVALID) {
-			if (__sync_bool_compare_and_swap(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
-				s->id = id;
-				s->fd = -1;
-				return id;
-			} else {
-				// retry
-				--i;
-			}
+	while (__sync_lock_test_and_set(&ss->free_lock,1)) {}
+	struct socket *s = ss->free_head;
+	if (s == NULL && new_page(ss)) {
+		s = ss->free_head;
+	}
+	if (s) {
+		ss->free_head = s->next;
+		if (ss->free_head == NULL) {
+			ss->free_tail = NULL;
 		}
 	}
-	return -1;
+	__sync_lock_release(&ss->free_lock);
+	if (s == NULL) {
+		return -1;
+	}
+	assert(s->type == SOCKET_TYPE_INVALID);
+	/*the low bits of n is the index of the slot*/
+	int n = ((unsigned)s->id / ss->nshard + ss->max_slot) & ss->alloc_mask;
+	s->type = SOCKET_TYPE_RESERVE;
+	s->id = n * ss->nshard + ss->shard;
+	s->fd = -1;
+	return s->id;
 }
 
 /**
@@ -355,11 +541,17 @@ clear_wb_list(struct wb_list *list) {
 
 /**
  * @brief create server manager for skynet 
+ * @param[in] shard index of this server
+ * @param[in] nshard tot servers
+ * @param[in] max_event max events of one wait, 0 for default
+ * @param[in] slot slots alloc at first, the table grows when they are used up
+ * @param[in] max_slot max sockets of this server, 0 for default (MAX_SOCKET)
  * @return handle for server in skynet
  */
 struct socket_server * 
-socket_server_create() {
+socket_server_create(int shard, int nshard, int max_event, int slot, int max_slot) {
 	int i;
+	assert(shard >= 0 && shard < nshard);
 	int fd[2];
 	/*handle for epoll init*/
 	poll_fd efd = sp_create();
@@ -367,18 +559,28 @@ socket_server_create() {
 		fprintf(stderr, "socket-server: create event pool failed.\n");
 		return NULL;
 	}
-	/*create pipe*/
-	if (pipe(fd)) {
+	/*create wakeup fd*/
+#if defined(__linux__)
+	fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd[0] < 0) {
+#else
+	if (pipe(fd) == 0) {
+		sp_nonblocking(fd[0]);
+		sp_nonblocking(fd[1]);
+	} else {
+#endif
 		sp_release(efd);
-		fprintf(stderr, "socket-server: create socket pair failed.\n");
+		fprintf(stderr, "socket-server: create wakeup fd failed.\n");
 		return NULL;
 	}
-	/*listen read of pipe to recive the msg from the module*/
+	/*listen the wakeup fd, the commands from the module are in ctrl ring*/
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
 		close(fd[0]);
-		close(fd[1]);
+		if (fd[1] != fd[0]) {
+			close(fd[1]);
+		}
 		sp_release(efd);
 		return NULL;
 	}
@@ -389,28 +591,60 @@ socket_server_create() {
 	/*store the epoll handle in manager*/
 	ss->event_fd = efd;
 
-	/*here!! You see, pipe get the request msg from module to socket*/
+	/*here!! You see, ctrl ring get the request msg from module to socket*/
 
-        /*store the fd of pipe in socket manager*/
+        /*store the wakeup fd in socket manager*/
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
 
-	/*check ctrl in default*/
-	ss->checkctrl = 1;
-
-	/*init all socket handle*/
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
-		s->type = SOCKET_TYPE_INVALID;
-		clear_wb_list(&s->high);
-		clear_wb_list(&s->low);
-	}
-	ss->alloc_id = 0;
+	ss->udp = NULL;
+	ss->udp_flush_n = 0;
+	ss->udp_flush_cmd = 0;
+
+	ss->ctrl_wait = 0;
+	ss->ctrl_head = 0;
+	ss->ctrl_tail = 0;
+	for (i=0;i<CTRL_RING_SIZE;i++) {
+		ss->ctrl[i].seq = i;
+	}
+
+	ss->shard = shard;
+	ss->nshard = nshard;
+	/*the largest 2^n-1 that shard + alloc_mask * nshard doesn't overflow*/
+	ss->alloc_mask = 0x7fffffff;
+	while (ss->alloc_mask > (0x7fffffff - shard) / nshard) {
+		ss->alloc_mask >>= 1;
+	}
+	/*init the slot table, max_slot is rounded up to power of 2*/
+	if (max_slot <= 0) {
+		max_slot = MAX_SOCKET;
+	}
+	ss->max_slot = SLOT_PAGE;
+	while (ss->max_slot < max_slot && ss->max_slot <= ss->alloc_mask / 2) {
+		ss->max_slot <<= 1;
+	}
+	ss->free_lock = 0;
+	ss->free_head = NULL;
+	ss->free_tail = NULL;
+	ss->npage = 0;
+	ss->page = MALLOC(ss->max_slot / SLOT_PAGE * sizeof(struct socket *));
+	memset(ss->page, 0, ss->max_slot / SLOT_PAGE * sizeof(struct socket *));
+	do {
+		new_page(ss);
+	} while (ss->npage * SLOT_PAGE < slot && ss->npage < ss->max_slot / SLOT_PAGE);
+	memset(&ss->invalid, 0, sizeof(ss->invalid));
+	ss->invalid.type = SOCKET_TYPE_INVALID;
+	ss->invalid.id = -1;
+	ss->next_peer = 0;
+	ss->peer = NULL;
 	ss->event_n = 0;
 	ss->event_index = 0;
+	ss->max_accept = 1;
+	ss->accept_n = 0;
+	ss->rawaddr = false;
+	ss->max_event = max_event > 0 ? max_event : MAX_EVENT;
+	ss->ev = MALLOC(ss->max_event * sizeof(struct event));
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
 
 	return ss;
 }
@@ -453,10 +687,14 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_message *r
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
 		sp_del(ss->event_fd, s->fd);
 	}
+	// the worker may be writing the fd directly, see direct_write
+	SOCKET_LOCK(s);
 	if (s->type != SOCKET_TYPE_BIND) {
 		close(s->fd);
 	}
 	s->type = SOCKET_TYPE_INVALID;
+	SOCKET_UNLOCK(s);
+	push_free(ss, s);
 }
 
 
@@ -469,17 +707,25 @@ socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
 	/*release the socket */
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+	for (i=0;i<ss->npage * SLOT_PAGE;i++) {
+		struct socket *s = &ss->page[i >> SLOT_PAGE_P][i & (SLOT_PAGE - 1)];
 		if (s->type != SOCKET_TYPE_RESERVE) {
 			force_close(ss, s , &dummy);
 		}
 	}
-	/*close ctrl pipe*/
-	close(ss->sendctrl_fd);
+	for (i=0;i<ss->npage;i++) {
+		FREE(ss->page[i]);
+	}
+	FREE(ss->page);
+	/*close wakeup fd*/
+	if (ss->sendctrl_fd != ss->recvctrl_fd) {
+		close(ss->sendctrl_fd);
+	}
 	close(ss->recvctrl_fd);
 	/*close epoll*/
 	sp_release(ss->event_fd);
+	FREE(ss->ev);
+	FREE(ss->udp);
 	FREE(ss);
 }
 
@@ -501,23 +747,23 @@ check_wb_list(struct wb_list *s) {
  * @param[in] protocol protocol for the socket
  * @param[in] opaque id of the module create this socket 
  * @param[in] add  flag that if need register read event
- * return success ? socket : NULL
+ * return success ? socket : NULL, the caller frees the slot reserved when fail
  */
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	/*conflict, error*/
 	assert(s->type == SOCKET_TYPE_RESERVE);
 
 	if (add) {
 	        /*add read event*/
 		if (sp_add(ss->event_fd, fd, s)) {
-			s->type = SOCKET_TYPE_INVALID;
 			return NULL;
 		}
 	}
 
 	s->id = id;                  /*record the socket id*/
+	s->group = -1;               /*not a member of listen group*/
 	s->fd = fd;                  /*record the socket file description*/
 	s->protocol = protocol;      /*record the protocol*/
 	s->p.size = MIN_READ_BUFFER; /*set the origin read buffer size*/
@@ -525,6 +771,10 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 
 	/*init the write buffer*/
 	s->wb_size = 0;
+	s->warn_high = 0;
+	s->warn_low = 0;
+	s->warn = 0;
+	s->direct_rest = 0;
 	check_wb_list(&s->high);    /*high rate payload list*/
 	check_wb_list(&s->low);     /*loew rate payload list*/
 	return s;
@@ -619,7 +869,7 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 	return -1;
 _failed:
 	freeaddrinfo( ai_list );
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	free_slot(ss, get_socket(ss, id));
 	return SOCKET_ERROR;
 }
 
@@ -628,13 +878,25 @@ _failed:
  * @param[in] ss socket manger
  * @param[in] list  list of payload wait to send 
  * @param[out] result msg result 
+ * @note gather at most MAX_IOV buffers of the list in one writev
  */ 
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct iovec iov[MAX_IOV];
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
+		int n = 0;
+		ssize_t total = 0;
+		while (tmp && n < MAX_IOV) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			total += tmp->sz;
+			++n;
+			tmp = tmp->next;
+		}
+		ssize_t sz;
 		for (;;) {
-			int sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -648,17 +910,28 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				force_close(ss,s, result);
 				return SOCKET_CLOSE;
 			}
-			/*write buffer into socket here*/
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
-				return -1;
-			}
 			break;
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		/*write buffer into socket here*/
+		s->wb_size -= sz;
+		ssize_t left = sz;
+		while ((tmp = list->head) != NULL) {
+			if (left < tmp->sz) {
+				/*the last buffer is written a part*/
+				tmp->ptr += left;
+				tmp->sz -= left;
+				break;
+			}
+			left -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+		if (sz != total) {
+			if (list->head == NULL) {
+				list->tail = NULL;
+			}
+			return -1;
+		}
 	}
 	list->tail = NULL;
 
@@ -707,12 +980,35 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		union sockaddr_all sa;
+		struct write_buffer * tmp;
+		union sockaddr_all sa[UDP_BATCH];
+		int i, n = 0;
+#if defined(__linux__)
+		/*gather the datagrams in the list, send them by one sendmmsg*/
+		struct mmsghdr msg[UDP_BATCH];
+		struct iovec iov[UDP_BATCH];
+		memset(msg, 0, sizeof(msg));
+		for (tmp = list->head; tmp && n < UDP_BATCH; tmp = tmp->next, n++) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			msg[n].msg_hdr.msg_name = &sa[n];
+			/*conver all udp address to normal address*/
+			msg[n].msg_hdr.msg_namelen = udp_socket_address(s, tmp->udp_address, &sa[n]);
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+		}
+		int err = sendmmsg(s->fd, msg, n, 0);
+#else
+		tmp = list->head;
+		n = 1;
 		/*conver all udp address to normal address*/
-		socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa);
+		socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa[0]);
 		/*send udp packet*/
-		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa.s, sasz);
+		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa[0].s, sasz);
+		if (err >= 0) {
+			err = 1;
+		}
+#endif
 		if (err < 0) {
 			switch(errno) {
 			/*ignore all erro in udp send*/
@@ -733,9 +1029,13 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 */
 		}
 
-		s->wb_size -= tmp->sz;
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		/*err datagrams sent, the error of the next one (if any) is reported by next call*/
+		for (i=0;i<err;i++) {
+			tmp = list->head;
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
 	}
 	list->tail = NULL;
 
@@ -780,6 +1080,8 @@ list_uncomplete(struct wb_list *s) {
  */
 static void
 raise_uncomplete(struct socket * s) {
+	// both lists look empty in the middle, don't let the worker write directly (see direct_write)
+	SOCKET_LOCK(s);
 	struct wb_list *low = &s->low;
 	struct write_buffer *tmp = low->head;
 	low->head = tmp->next;
@@ -793,6 +1095,7 @@ raise_uncomplete(struct socket * s) {
 
 	tmp->next = NULL;
 	high->head = high->tail = tmp;
+	SOCKET_UNLOCK(s);
 }
 
 /*
@@ -907,6 +1210,38 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 	s->wb_size += buf->sz;
 }
 
+/**
+ * @brief put the rest of a direct write into the head of high write buffer list
+ * @param[in] ss socket manager
+ * @param[in] s socket
+ * @param[in] request hold the payload written partly by the worker
+ * @param[in] n size written by the worker
+ */
+static void
+prepend_sendbuffer(struct socket_server *ss, struct socket *s, struct request_send * request, int n) {
+	struct wb_list *high = &s->high;
+	struct write_buffer *head = high->head;
+	struct write_buffer *tail = high->tail;
+	high->head = high->tail = NULL;
+	append_sendbuffer(ss, s, request, n);
+	if (head) {
+		high->head->next = head;
+		high->tail = tail;
+	}
+}
+
+/**
+ * @brief wait for the worker writing fd directly (see direct_write)
+ * @return true if the rest of its payload is in the ctrl ring, the payloads before it must not be written
+ */
+static inline int
+direct_pending(struct socket *s) {
+	SOCKET_LOCK(s);
+	int rest = s->direct_rest;
+	SOCKET_UNLOCK(s);
+	return rest;
+}
+
 /**
  * @brief check if the write buffer is empty
  */
@@ -915,6 +1250,78 @@ send_buffer_empty(struct socket *s) {
 	return (s->high.head == NULL && s->low.head == NULL);
 }
 
+/**
+ * @brief delay the udp send when more commands wait, the datagrams are sent together by flush_udp
+ * @return true if the socket is recorded for flush
+ */
+static inline bool
+defer_udp(struct socket_server *ss, struct socket *s) {
+	if (ss->udp_flush_n >= UDP_FLUSH || !has_cmd(ss)) {
+		return false;
+	}
+	if (ss->udp_flush_n == 0) {
+		ss->udp_flush_cmd = 0;
+	}
+	ss->udp_flush[ss->udp_flush_n++] = s->id;
+	return true;
+}
+
+/**
+ * @brief send the datagrams of the udp sockets recorded by defer_udp
+ * @param[in] ss socket manager
+ * @note the rest (EAGAIN) is sent when the write event occured
+ */
+static void
+flush_udp(struct socket_server *ss) {
+	int i;
+	for (i=0;i<ss->udp_flush_n;i++) {
+		int id = ss->udp_flush[i];
+		struct socket * s = get_socket(ss, id);
+		if (s->id != id || s->protocol == PROTOCOL_TCP || send_buffer_empty(s)) {
+			// closed or reused
+			continue;
+		}
+		if (s->type == SOCKET_TYPE_CONNECTED) {
+			send_list_udp(ss, s, &s->high, NULL);
+			if (s->high.head == NULL) {
+				send_list_udp(ss, s, &s->low, NULL);
+			}
+		}
+		if (!send_buffer_empty(s)) {
+			sp_write(ss->event_fd, s->fd, s, true);
+		}
+	}
+	ss->udp_flush_n = 0;
+}
+
+/**
+ * @brief check if wb_size crosses the watermarks
+ * @param[in] ss socket manager
+ * @param[in] s socket
+ * @param[out] result ud is the KB wait to send when rises to warn_high, 0 when falls to warn_low
+ * @return SOCKET_WARNING when crossed, or -1
+ */
+static int
+check_watermark(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (s->warn) {
+		if (s->wb_size > s->warn_low) {
+			return -1;
+		}
+		s->warn = 0;
+		result->ud = 0;
+	} else {
+		if (s->warn_high <= 0 || s->wb_size < s->warn_high) {
+			return -1;
+		}
+		s->warn = 1;
+		result->ud = (int)((s->wb_size + 1023) / 1024);
+	}
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->data = NULL;
+	return SOCKET_WARNING;
+}
+
 /*
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
 
@@ -925,19 +1332,37 @@ send_buffer_empty(struct socket *s) {
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	struct send_object so;
 	/*convert obj to send_obj*/
 	send_object_init(ss, &so, request->buffer, request->sz);
 	/*check the status of the socket*/
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id 
-		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| (s->type == SOCKET_TYPE_HALFCLOSE && request->offset == 0)
 		|| s->type == SOCKET_TYPE_PACCEPT) {
 		so.free_func(request->buffer);
 		return -1;
 	}
 	assert(s->type != SOCKET_TYPE_PLISTEN && s->type != SOCKET_TYPE_LISTEN);
 
+	if (request->offset > 0) {
+		// the worker has written a part directly (see direct_write), the rest is before the payloads kept after it
+		prepend_sendbuffer(ss, s, request, request->offset);
+		s->direct_rest = 0;
+		sp_write(ss->event_fd, s->fd, s, true);
+		return check_watermark(ss, s, result);
+	}
+
+	if (s->protocol == PROTOCOL_TCP && direct_pending(s)) {
+		// keep the payload without writing, until the rest of the direct write arrives
+		if (priority == PRIORITY_LOW) {
+			append_sendbuffer_low(ss, s, request);
+		} else {
+			append_sendbuffer(ss, s, request, 0);
+		}
+		return check_watermark(ss, s, result);
+	}
+
 	/*connected but write buffer empty*/
 	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
 	        /*write buffer list is empty!!! so we can try to send directly*/
@@ -968,6 +1393,10 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			if (udp_address == NULL) {
 				udp_address = s->p.udp_address;
 			}
+			if (defer_udp(ss, s)) {
+				append_sendbuffer_udp(ss,s,priority,request,udp_address);
+				return check_watermark(ss, s, result);
+			}
 			union sockaddr_all sa;
 			socklen_t sasz = udp_socket_address(s, udp_address, &sa);
 			int n = sendto(s->fd, so.buffer, so.sz, 0, &sa.s, sasz);
@@ -995,7 +1424,7 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
-	return -1;
+	return check_watermark(ss, s, result);
 }
 
 /**
@@ -1018,6 +1447,7 @@ listen_socket(struct socket_server *ss, struct request_listen * request, struct
 		goto _failed;
 	}
 	s->type = SOCKET_TYPE_PLISTEN;
+	s->group = request->group;
 	return -1;
 _failed:
 	close(listen_fd);
@@ -1025,7 +1455,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = NULL;
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	free_slot(ss, get_socket(ss, id));
 
 	return SOCKET_ERROR;
 }
@@ -1040,7 +1470,7 @@ _failed:
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
 		result->id = id;
 		result->opaque = request->opaque;
@@ -1048,8 +1478,10 @@ close_socket(struct socket_server *ss, struct request_close *request, struct soc
 		result->data = NULL;
 		return SOCKET_CLOSE;
 	}
+	// the rest of a direct write will come, close after sending it
+	int rest = direct_pending(s);
 	/*try to clean all payload in the write buffer list*/
-	if (!send_buffer_empty(s)) { 
+	if (!send_buffer_empty(s) && !rest) { 
 		int type = send_buffer(ss,s,result);
 		/*try again, if there is payload wait to send*/
 		if (type != -1)
@@ -1057,11 +1489,12 @@ close_socket(struct socket_server *ss, struct request_close *request, struct soc
 	}
         
         /*close socket after all payload sended */
-	if (send_buffer_empty(s)) {
+	if (send_buffer_empty(s) && !rest) {
+		bool member = s->group >= 0 && s->group != id;
 		force_close(ss,s,result);
 		result->id = id;
 		result->opaque = request->opaque;
-		return SOCKET_CLOSE;
+		return member ? -1 : SOCKET_CLOSE;
 	}
 	/*set as half close when close socket with payload left*/
 	s->type = SOCKET_TYPE_HALFCLOSE;
@@ -1085,6 +1518,7 @@ bind_socket(struct socket_server *ss, struct request_bind *request, struct socke
 	/*init the socket, tcp need bind*/
 	struct socket *s = new_fd(ss, id, request->fd, PROTOCOL_TCP, request->opaque, true);
 	if (s == NULL) {
+		free_slot(ss, get_socket(ss, id));
 		result->data = NULL;
 		return SOCKET_ERROR;
 	}
@@ -1110,7 +1544,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 
 	/*check the socket wait to start*/
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
@@ -1121,12 +1555,16 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	if (s->type == SOCKET_TYPE_PACCEPT || s->type == SOCKET_TYPE_PLISTEN) {
 	        /*register the read evet*/
 		if (sp_add(ss->event_fd, s->fd, s)) {
-			s->type = SOCKET_TYPE_INVALID;
+			free_slot(ss, s);
 			return SOCKET_ERROR;
 		}
 		/*update the type of the socket*/
 		s->type = (s->type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN;
 		s->opaque = request->opaque;
+		if (s->group >= 0 && s->group != id) {
+			/*member of listen group, the module only knows the first one*/
+			return -1;
+		}
 		result->data = "start";
 		return SOCKET_OPEN;
 	} else if (s->type == SOCKET_TYPE_CONNECTED) {
@@ -1148,7 +1586,7 @@ static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
 	/*get the socket */
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return;
 	}
@@ -1158,47 +1596,81 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 }
 
 /**
- * @brief block read ctrl msg from the pipe
- * @param[in] fd of the pipe
- * @param[out] hold payload  from the pipe
- * @param[in] sz the size of the storage which used to get payload
+ * @brief set the watermarks of the write buffer
+ * @param[in] ss socket manager
+ * @param[in] request request msg
+ * @param[out] result SOCKET_WARNING when wb_size crosses the new watermarks
  */
-static void
-block_readpipe(int pipefd, void *buffer, int sz) {
-	for (;;) {
-	        /*try to read msg from pipe*/
-		int n = read(pipefd, buffer, sz);
-		if (n<0) {
-		    /*continue if EINTR occured*/
-			if (errno == EINTR)
-				continue;
-			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
-			return;
-		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
+static int
+watermark_socket(struct socket_server *ss, struct request_watermark *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+		return -1;
 	}
+	s->warn_high = request->high;
+	s->warn_low = request->low < request->high ? request->low : request->high;
+	if (s->warn && s->warn_high <= 0) {
+		// disabled, the producers waiting for the buffer drained should go on
+		s->warn_low = INT64_MAX;
+	}
+	return check_watermark(ss, s, result);
 }
 
 /**
- * @brief wait request msg from usr and slove this msg
- * @param[ss] socket manager
+ * @brief pop one ctrl command from the ring
+ * @param[in] ss socket manager
+ * @param[out] buffer hold the request
+ * @return type of the command, 0 if the ring is empty
+ * @note only socket thread call it
  */
 static int
-has_cmd(struct socket_server *ss) {
-        
-        /*nonblock */
-	struct timeval tv = {0,0};
-	int retval;
+pop_ctrl(struct socket_server *ss, void *buffer) {
+	unsigned pos = ss->ctrl_head;
+	struct ctrl_entry *e = &ss->ctrl[pos & (CTRL_RING_SIZE-1)];
+	if (*(volatile unsigned *)&e->seq != pos + 1) {
+		return 0;
+	}
+	__sync_synchronize();
+	int type = e->type;
+	memcpy(buffer, e->u.buffer, e->len);
+	__sync_synchronize();
+	// the entry can be reused by producer after one round
+	e->seq = pos + CTRL_RING_SIZE;
+	ss->ctrl_head = pos + 1;
+	return type;
+}
 
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
+/**
+ * @brief check if there is ctrl command wait for socket thread
+ */
+static inline int
+has_cmd(struct socket_server *ss) {
+	unsigned pos = ss->ctrl_head;
+	struct ctrl_entry *e = &ss->ctrl[pos & (CTRL_RING_SIZE-1)];
+	return *(volatile unsigned *)&e->seq == pos + 1;
+}
 
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
-		return 1;
+/**
+ * @brief drain the wakeup fd
+ */
+static void
+clear_wakeup(struct socket_server *ss) {
+	char tmp[64];
+	while (read(ss->recvctrl_fd, tmp, sizeof(tmp)) > 0) {
 	}
-	return 0;
+}
+
+/**
+ * @brief take over the fd accepted by other shard
+ * @param[in] ss socket manager
+ * @param[in] request the id reserved in this shard and the fd
+ */
+static void
+accept_socket(struct socket_server *ss, struct request_accept *request) {
+	struct socket *ns = new_fd(ss, request->id, request->fd, PROTOCOL_TCP, request->opaque, false);
+	/*wait for start like the socket accepted by this shard*/
+	ns->type = SOCKET_TYPE_PACCEPT;
 }
 
 /** 
@@ -1222,7 +1694,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		free_slot(ss, get_socket(ss, id));
 		return;
 	}
 	/*!!!here, marked as connected directly*/
@@ -1239,7 +1711,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return -1;
 	}
@@ -1268,17 +1740,7 @@ set_udp_address(struct socket_server *ss, struct request_setudp *request, struct
  * @param[in] result result msg from the usr
  */
 static int
-ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
-	// the length of message is one byte, so 256+8 buffer size is enough.
-	uint8_t buffer[256];
-	uint8_t header[2];
-	/*TODO select pipe, why use select???*/
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	/*read ctrl msg*/
-	block_readpipe(fd, buffer, len);
+ctrl_cmd(struct socket_server *ss, int type, void *buffer, struct socket_message *result) {
 
 	// ctrl command only exist in local fd, so don't worry about endian.
 	switch (type) {
@@ -1305,11 +1767,13 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		result->data = NULL;
 		return SOCKET_EXIT;
 	case 'D':
-	        //Send package (high)
-		return send_socket(ss, (struct request_send *)buffer, result, PRIORITY_HIGH, NULL);
-	case 'P':
-	        //Send package (low)
-		return send_socket(ss, (struct request_send *)buffer, result, PRIORITY_LOW, NULL);
+	case 'P': {
+	        //Send package (high or low)
+		struct request_send * request = (struct request_send *)buffer;
+		int ret = send_socket(ss, request, result, type == 'D' ? PRIORITY_HIGH : PRIORITY_LOW, NULL);
+		__sync_sub_and_fetch(&get_socket(ss, request->id)->sending, 1);
+		return ret;
+	}
 	case 'A': {
 	        //A Send UDP package
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
@@ -1322,10 +1786,17 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	        //Set opt
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'W':
+	        //Set watermarks of the write buffer
+		return watermark_socket(ss, (struct request_watermark *)buffer, result);
 	case 'U':
 	        //Create UDP socket
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'F':
+	        //Take over accepted fd
+		accept_socket(ss, (struct request_accept *)buffer);
+		return -1;
 	default:
 		fprintf(stderr, "socket-server: Unknown ctrl %c.\n",type);
 		return -1;
@@ -1345,10 +1816,10 @@ static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_message * result) {
     	/*try to read from the fd*/
         int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	char * buffer = socket_buffer_alloc(ss->shard, sz);
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
-		FREE(buffer);
+		socket_buffer_free(buffer);
 		switch(errno) {
 		case EINTR:
 			break;
@@ -1363,14 +1834,14 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_me
 		return -1;
 	}
 	if (n==0) {
-		FREE(buffer);
+		socket_buffer_free(buffer);
 		force_close(ss, s, result);
 		return SOCKET_CLOSE;
 	}
         
 	if (s->type == SOCKET_TYPE_HALFCLOSE) {
 		// discard recv data
-		FREE(buffer);
+		socket_buffer_free(buffer);
 		return -1;
 	}
 
@@ -1416,51 +1887,116 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+/**
+ * @brief alloc the udp receive buffers of the socket thread
+ */
+static struct udp_batch *
+udp_batch_new(void) {
+	struct udp_batch * u = MALLOC(sizeof(*u));
+	memset(u, 0, offsetof(struct udp_batch, buffer));
+#if defined(__linux__)
+	int i;
+	for (i=0;i<UDP_BATCH;i++) {
+		u->iov[i].iov_base = u->buffer[i];
+		u->iov[i].iov_len = MAX_UDP_PACKAGE;
+		u->msg[i].msg_hdr.msg_name = &u->addr[i];
+		u->msg[i].msg_hdr.msg_iov = &u->iov[i];
+		u->msg[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	return u;
+}
+
+/**
+ * @brief recive udp datagrams, up to UDP_BATCH by one recvmmsg
+ * @return tot datagrams, -1 for error
+ */
+static int
+recv_udp(struct udp_batch *u, int fd) {
+#if defined(__linux__)
+	int i;
+	for (i=0;i<UDP_BATCH;i++) {
+		u->msg[i].msg_hdr.msg_namelen = sizeof(u->addr[i]);
+	}
+	int n = recvmmsg(fd, u->msg, UDP_BATCH, 0, NULL);
+	for (i=0;i<n;i++) {
+		u->sz[i] = u->msg[i].msg_len;
+		u->addrsz[i] = u->msg[i].msg_hdr.msg_namelen;
+	}
+#else
+	socklen_t slen = sizeof(u->addr[0]);
+	/*try to recive udp packet with size 65535*/
+	int n = recvfrom(fd, u->buffer[0], MAX_UDP_PACKAGE, 0, &u->addr[0].s, &slen);
+	if (n >= 0) {
+		u->sz[0] = n;
+		u->addrsz[0] = slen;
+		n = 1;
+	}
+#endif
+	return n;
+}
+
 /**
  * @brief recive udp payload from socket
  * @param[in] ss socket manager
  * @param[in] s socket 
  * @param[in] result hold the return msg
+ * @note the datagrams received together are returned by the next calls of the same socket
  */
 static int
 forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_message * result) {
-	union sockaddr_all sa;
-	socklen_t slen = sizeof(sa);
-	/*try to recive udp packet with size 65535*/
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
-	if (n<0) {
-		switch(errno) {
-		case EINTR:
-		case EAGAIN:
-			break;
-		default:
-			// close when error
-			force_close(ss, s, result);
-			return SOCKET_ERROR;
-		}
-		return -1;
+	struct udp_batch * u = ss->udp;
+	if (u == NULL) {
+		u = ss->udp = udp_batch_new();
 	}
-	uint8_t * data;
-	if (slen == sizeof(sa.v4)) {
-		if (s->protocol != PROTOCOL_UDP)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
-		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
-	} else {
-		if (s->protocol != PROTOCOL_UDPv6)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
-		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
+	if (u->id != s->id) {
+		// the pending datagrams belong to a closed socket
+		u->id = s->id;
+		u->n = u->index = 0;
 	}
-	memcpy(data, ss->udpbuffer, n);
-        
-        /*udp payload as the result msg*/
-	result->opaque = s->opaque;
-	result->id = s->id;
-	result->ud = n;                 /*ud is the payload size of the udp*/
-	result->data = (char *)data;
+	for (;;) {
+		if (u->index == u->n) {
+			u->n = u->index = 0;
+			int n = recv_udp(u, s->fd);
+			if (n<0) {
+				switch(errno) {
+				case EINTR:
+				case EAGAIN:
+					break;
+				default:
+					// close when error
+					force_close(ss, s, result);
+					return SOCKET_ERROR;
+				}
+				return -1;
+			}
+			u->n = n;
+		}
+		int i = u->index++;
+		int n = u->sz[i];
+		union sockaddr_all *sa = &u->addr[i];
+		uint8_t * data;
+		if (u->addrsz[i] == sizeof(sa->v4)) {
+			if (s->protocol != PROTOCOL_UDP)
+				continue;
+			data = socket_buffer_alloc(ss->shard, n + 1 + 2 + 4);
+			gen_udp_address(PROTOCOL_UDP, sa, data + n);
+		} else {
+			if (s->protocol != PROTOCOL_UDPv6)
+				continue;
+			data = socket_buffer_alloc(ss->shard, n + 1 + 2 + 16);
+			gen_udp_address(PROTOCOL_UDPv6, sa, data + n);
+		}
+		memcpy(data, u->buffer[i], n);
 
-	return SOCKET_UDP;
+		/*udp payload as the result msg*/
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = n;                 /*ud is the payload size of the udp*/
+		result->data = (char *)data;
+
+		return SOCKET_UDP;
+	}
 }
 
 /**
@@ -1521,15 +2057,15 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 
 	/*accpet usr and try to get fd*/
 	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
+#if defined(__linux__)
+	/*nonblock by accept4, keepalive is inherited from the listen socket (see do_listen)*/
+	int client_fd = accept4(s->fd, &u.s, &len, SOCK_NONBLOCK);
 	if (client_fd < 0) {
 		return 0;
 	}
-
-	/*get id for this client*/
-	int id = reserve_id(ss);
-	if (id < 0) {
-		close(client_fd);
+#else
+	int client_fd = accept(s->fd, &u.s, &len);
+	if (client_fd < 0) {
 		return 0;
 	}
 
@@ -1537,6 +2073,38 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	socket_keepalive(client_fd);
 	/*set the clinet as nonblock*/
 	sp_nonblocking(client_fd);
+#endif
+
+	/*get id for this client, hand it to the shards by turns if the listen socket is not SO_REUSEPORT*/
+	int id = -1;
+	if (ss->peer && s->group < 0) {
+		struct socket_server *target = ss->peer[ss->next_peer++ % ss->nshard];
+		if (target != ss) {
+			id = reserve_id(target);
+			if (id >= 0) {
+				struct request_package request;
+				request.u.accept.id = id;
+				request.u.accept.fd = client_fd;
+				request.u.accept.opaque = s->opaque;
+				// don't wait for the peer, it may wait for this thread too
+				if (push_request(target, &request, 'F', sizeof(request.u.accept), false)) {
+					free_slot(target, get_socket(target, id));
+					id = -1;
+				} else {
+					target = NULL;
+				}
+			}
+		}
+		if (target == NULL) {
+			goto _report;
+		}
+	}
+	id = reserve_id(ss);
+	if (id < 0) {
+		close(client_fd);
+		return 0;
+	}
+
 	/*alloc new socket manager and register read fd*/
 	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
@@ -1546,11 +2114,19 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 
 	/*change type to PACCEPT*/
 	ns->type = SOCKET_TYPE_PACCEPT;
+_report:
 	/*store the attributes into the result*/
 	result->opaque = s->opaque; /*store the module id listen fd belong to*/
-	result->id = s->id;         /*listen socket id*/
+	result->id = s->group >= 0 ? s->group : s->id; /*listen socket id*/
 	result->ud = id;            /*client socket id*/
 	result->data = NULL;
+
+	if (ss->rawaddr) {
+		/*formatted by the module when needed, see socket_server_format_address*/
+		gen_udp_address(u.s.sa_family == AF_INET ? PROTOCOL_UDP : PROTOCOL_UDPv6, &u, (uint8_t *)ss->buffer);
+		result->data = ss->buffer;
+		return 1;
+	}
         
         /*store the address in string*/
 	void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
@@ -1594,34 +2170,47 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
  * @param[in] ss manager of all socket
  * @param[out] result hold result msg
  * @param[out] more set as 0  when read or write evnet occured
+ * @param[in] wait wait for events, or return -1 when the events of last wait are all handled
  * @return type
  *
  */
-int 
-socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+static int 
+poll_result(struct socket_server *ss, struct socket_message * result, int * more, bool wait) {
+	union {
+		char buffer[256];
+		void * align;
+	} cmd;
 	for (;;) {
-	        //1. try to get the ctrl msg from modules by pipe
-		if (ss->checkctrl) {
-		        /*try to get msg from pipe*/
-			if (has_cmd(ss)) {
-                                /*run ctrl msg and get the result*/
-				int type = ctrl_cmd(ss, result);
-				if (type != -1) {
-				        /*fail, so we clear the event*/
-					clear_closed_event(ss, result, type);
-					return type;
-				} else
-					continue;
-			} else {
-			        
-				ss->checkctrl = 0;
+	        //1. try to get the ctrl msg from modules by ctrl ring
+		int ctrl = pop_ctrl(ss, cmd.buffer);
+		if (ctrl) {
+                        /*run ctrl msg and get the result*/
+			int type = ctrl_cmd(ss, ctrl, cmd.buffer, result);
+			if (ss->udp_flush_n && (++ss->udp_flush_cmd >= UDP_FLUSH || !has_cmd(ss))) {
+				flush_udp(ss);
 			}
+			if (type != -1) {
+			        /*fail, so we clear the event*/
+				clear_closed_event(ss, result, type);
+				return type;
+			} else
+				continue;
 		}
 		//2.try to get more event if all the event occured solved
 		if (ss->event_index == ss->event_n) {
+			if (!wait) {
+				return -1;
+			}
+			/*ask the producer to wakeup us, and check again*/
+			ss->ctrl_wait = 1;
+			__sync_synchronize();
+			if (has_cmd(ss)) {
+				ss->ctrl_wait = 0;
+				continue;
+			}
 		        /*wait event occured and record what occured*/
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
-			ss->checkctrl = 1;
+			ss->event_n = sp_wait(ss->event_fd, ss->ev, ss->max_event);
+			ss->ctrl_wait = 0;
 			if (more) {
 				*more = 0;
 			}
@@ -1635,7 +2224,8 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;
 		if (s == NULL) {
-			// dispatch pipe message at beginning
+			// wakeup by ctrl command, dispatch it at beginning
+			clear_wakeup(ss);
 			continue;
 		}
 		//do action for the event's result msg
@@ -1646,8 +2236,15 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN:
 		        /*report to module that new connect accept*/
 			if (report_accept(ss, s, result)) {
+				// accept again until it fails, at most max_accept connections for one readiness
+				if (++ss->accept_n < ss->max_accept) {
+					--ss->event_index;
+				} else {
+					ss->accept_n = 0;
+				}
 				return SOCKET_ACCEPT;
 			} 
+			ss->accept_n = 0;
 			break;
 		case SOCKET_TYPE_INVALID:
 			fprintf(stderr, "socket-server: invalid socket\n");
@@ -1681,6 +2278,8 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			/*write payload after write event occured*/
 			if (e->write) {
 				int type = send_buffer(ss, s, result);
+				if (type == -1)
+					type = check_watermark(ss, s, result);
 				if (type == -1)
 					break;
 				clear_closed_event(ss, result, type);
@@ -1691,28 +2290,83 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
+/**
+ * @brief wait event by epoll
+ * @param[in] ss manager of all socket
+ * @param[out] result hold result msg
+ * @param[out] more set as 0  when read or write evnet occured
+ * @return type
+ */
+int 
+socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+	return poll_result(ss, result, more, true);
+}
+
+/**
+ * @brief handle the ctrl commands and the events of last wait, never wait
+ * @param[in] ss manager of all socket
+ * @param[out] result hold result msg
+ * @return type, -1 if nothing to handle
+ */
+int
+socket_server_trypoll(struct socket_server *ss, struct socket_message * result) {
+	return poll_result(ss, result, NULL, false);
+}
+
 /**
  * @brief send a ctrl msg to the module
  * @param[in] msg store
  * @param[in] type msg type
  * @param[in] msg tot len
+ * @param[in] wait wait for socket thread when the ring is full, or return -1
  */
-static void
-send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
+static int
+push_request(struct socket_server *ss, struct request_package *request, char type, int len, bool wait) {
+	struct ctrl_entry *e;
+	unsigned pos;
 	for (;;) {
-	        /*send ctrl msg to socket by pipe*/
-		int n = write(ss->sendctrl_fd, &request->header[6], len+2);
-		if (n<0) {
-			if (errno != EINTR) {
-				fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
+		pos = ss->ctrl_tail;
+		e = &ss->ctrl[pos & (CTRL_RING_SIZE-1)];
+		int diff = (int)(*(volatile unsigned *)&e->seq - pos);
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&ss->ctrl_tail, pos, pos + 1)) {
+				break;
 			}
-			continue;
+		} else if (diff < 0) {
+			if (!wait) {
+				return -1;
+			}
+			// ring is full, wait for socket thread
+			sched_yield();
+		}
+	}
+	e->type = (uint8_t)type;
+	e->len = (uint8_t)len;
+	memcpy(e->u.buffer, &request->u, len);
+	__sync_synchronize();
+	e->seq = pos + 1;
+	__sync_synchronize();
+	if (ss->ctrl_wait && __sync_bool_compare_and_swap(&ss->ctrl_wait, 1, 0)) {
+		uint64_t one = 1;
+		for (;;) {
+			/*wakeup socket thread*/
+			int n = write(ss->sendctrl_fd, &one, sizeof(one));
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			// EAGAIN means the wakeup fd is readable already
+			break;
 		}
-		assert(n == len+2);
-		return;
 	}
+	return 0;
+}
+
+/**
+ * @brief send a ctrl msg to the socket thread, wait if the ring is full
+ */
+static inline void
+send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
+	push_request(ss, request, type, len, true);
 }
 
 /**
@@ -1764,6 +2418,61 @@ socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * a
 
 // return -1 when error
 //
+/**
+ * @brief write the payload to fd in the worker thread, without the ctrl ring
+ * @param[in] ss socket manager
+ * @param[in] s socket
+ * @param[in] request payload wait to send
+ * @return 1 if the payload is handled, 0 if it should be sent by socket thread
+ * @note only when the socket is connected (tcp) and nothing is wait to send, so the order is kept.
+ *       If write a part, send the rest to socket thread, it will go to the head of high list, and
+ *       the payloads arrive at socket thread before the rest are kept in the list (see send_socket).
+ *       If nothing is written (EAGAIN or error), send the whole payload as a normal request.
+ */
+static int
+direct_write(struct socket_server *ss, struct socket *s, struct request_package *req, char type) {
+	struct request_send *request = &req->u.send;
+	if (s->protocol != PROTOCOL_TCP || s->type != SOCKET_TYPE_CONNECTED
+		|| __sync_lock_test_and_set(&s->lock, 1)) {
+		return 0;
+	}
+	__sync_synchronize();
+	if (s->id != request->id || s->type != SOCKET_TYPE_CONNECTED
+		|| s->sending != 0 || !send_buffer_empty(s)) {
+		SOCKET_UNLOCK(s);
+		return 0;
+	}
+	struct send_object so;
+	send_object_init(ss, &so, request->buffer, request->sz);
+	int n;
+	for (;;) {
+		n = write(s->fd, so.buffer, so.sz);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// EAGAIN, or error handled by socket thread
+			n = 0;
+		}
+		break;
+	}
+	if (n == so.sz) {
+		SOCKET_UNLOCK(s);
+		so.free_func(request->buffer);
+		return 1;
+	}
+	if (n > 0) {
+		// the rest must be before any other payload, the socket thread keeps them until it arrives
+		s->direct_rest = 1;
+	}
+	// count it in sending before unlock, so no other worker writes before it
+	__sync_add_and_fetch(&s->sending, 1);
+	SOCKET_UNLOCK(s);
+	request->offset = n;
+	send_request(ss, req, type, sizeof(*request));
+	return 1;
+}
+
 //
 /**
  * @brief build and send payload high 
@@ -1775,7 +2484,7 @@ socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * a
  */
 int64_t 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return -1;
 	}
@@ -1783,8 +2492,13 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 	struct request_package request;
 	request.u.send.id = id;
 	request.u.send.sz = sz;
+	request.u.send.offset = 0;
 	request.u.send.buffer = (char *)buffer;
 
+	if (direct_write(ss, s, &request, 'D')) {
+		return s->wb_size;
+	}
+	__sync_add_and_fetch(&s->sending, 1);
 	send_request(ss, &request, 'D', sizeof(request.u.send));
 	return s->wb_size;
 }
@@ -1799,7 +2513,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
  */
 void 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return;
 	}
@@ -1807,13 +2521,18 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 	struct request_package request;
 	request.u.send.id = id;
 	request.u.send.sz = sz;
+	request.u.send.offset = 0;
 	request.u.send.buffer = (char *)buffer;
 
+	if (direct_write(ss, s, &request, 'P')) {
+		return;
+	}
+	__sync_add_and_fetch(&s->sending, 1);
 	send_request(ss, &request, 'P', sizeof(request.u.send));
 }
 
 /**
- * @brief send socket manager exit msg by ctrl pipe
+ * @brief send socket manager exit msg by ctrl ring
  * @param[in] ss socket_server manager
  * return 
  */
@@ -1841,7 +2560,7 @@ socket_server_close(struct socket_server *ss, uintptr_t opaque, int id) {
 // return -1 means failed
 // or return AF_INET or AF_INET6
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, bool reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -1875,6 +2594,16 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+#ifdef SO_REUSEPORT
+	/*sockets of all shards listen the same port, kernel balances the connections*/
+	if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+		goto _failed;
+	}
+#else
+	if (reuseport) {
+		goto _failed;
+	}
+#endif
 	/*bind address*/
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
@@ -1894,14 +2623,21 @@ _failed_fd:
  * @param[in] host host limit
  * @param[in] port port to listen
  * @param[in] backlog limit of the listen
+ * @param[in] reuseport set SO_REUSEPORT
  */
 static int
-do_listen(const char * host, int port, int backlog) {
+do_listen(const char * host, int port, int backlog, bool reuseport) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
+	/*accept until EAGAIN, see socket_server_accept*/
+	sp_nonblocking(listen_fd);
+#if defined(__linux__)
+	/*the accepted sockets inherit keepalive from the listen socket*/
+	socket_keepalive(listen_fd);
+#endif
 	if (listen(listen_fd, backlog) == -1) {
 		close(listen_fd);
 		return -1;
@@ -1916,10 +2652,12 @@ do_listen(const char * host, int port, int backlog) {
  * @param[in] addr address string
  * @param[in] port port
  * @param[in] backlog listen limit
+ * @param[in] reuseport open the listen fd with SO_REUSEPORT
+ * @param[in] group id of the first listen socket of the group, -1 if it is the first one
  */
-int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
-	int fd = do_listen(addr, port, backlog);
+static int
+listen_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, bool reuseport, int group) {
+	int fd = do_listen(addr, port, backlog, reuseport);
 	if (fd < 0) {
 		return -1;
 	}
@@ -1932,10 +2670,39 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	request.u.listen.opaque = opaque;
 	request.u.listen.id = id;
 	request.u.listen.fd = fd;
+	request.u.listen.group = reuseport ? (group < 0 ? id : group) : -1;
 	send_request(ss, &request, 'L', sizeof(request.u.listen));
 	return id;
 }
 
+/**
+ * @brief build and send socket listen request to socket thread
+ * @param[in] ss socket manager
+ * @param[in] opaque module id the msg from 
+ * @param[in] addr address string
+ * @param[in] port port
+ * @param[in] backlog listen limit
+ */
+int 
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, false, -1);
+}
+
+/**
+ * @brief listen with SO_REUSEPORT, every shard owns a listen socket of the same port
+ * @param[in] ss socket manager
+ * @param[in] opaque module id the msg from 
+ * @param[in] addr address string
+ * @param[in] port port
+ * @param[in] backlog listen limit
+ * @param[in] group id returned by the first listen of the group, or -1 for the first one
+ * @note accept msg of the members is reported with the group id
+ */
+int 
+socket_server_listen_reuseport(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, int group) {
+	return listen_request(ss, opaque, addr, port, backlog, true, group);
+}
+
 /**
  * @brief build and send socket bind request to socket thread
  * @param[in] ss socket manager
@@ -1983,6 +2750,22 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+/**
+ * @brief set the watermarks of the write buffer, SOCKET_WARNING is reported when crossing them
+ * @param[in] ss socket manager
+ * @param[in] id id of the socket
+ * @param[in] high report when the bytes wait to send rise to it, 0 for disable
+ * @param[in] low report again when the bytes fall to it
+ */
+void
+socket_server_watermark(struct socket_server *ss, int id, int64_t high, int64_t low) {
+	struct request_package request;
+	request.u.watermark.id = id;
+	request.u.watermark.high = high;
+	request.u.watermark.low = low;
+	send_request(ss, &request, 'W', sizeof(request.u.watermark));
+}
+
 /**
  * @brief register the mem handle for payload
  * @param[in]ss socket manager
@@ -1993,6 +2776,84 @@ socket_server_userobject(struct socket_server *ss, struct socket_object_interfac
 	ss->soi = *soi;
 }
 
+/**
+ * @brief tell the socket server all the shards, the accepted sockets are handed to them by turns
+ * @param[in] ss socket manager
+ * @param[in] peer all socket servers indexed by shard, it must live longer than ss
+ */
+void
+socket_server_peer(struct socket_server *ss, struct socket_server **peer) {
+	ss->peer = ss->nshard > 1 ? peer : NULL;
+}
+
+/**
+ * @brief set how the listen sockets accept, call it before the socket thread starts
+ * @param[in] ss socket manager
+ * @param[in] max_accept max connections accepted for one readiness of the listen socket
+ * @param[in] rawaddr report the peer address in udp address format instead of "ip:port"
+ */
+void
+socket_server_accept(struct socket_server *ss, int max_accept, int rawaddr) {
+	ss->max_accept = max_accept > 1 ? max_accept : 1;
+	ss->rawaddr = rawaddr != 0;
+}
+
+/**
+ * @brief size of the peer address in udp address format
+ * @param[in] addr the peer address of SOCKET_ACCEPT
+ * @return size, or 0 if addr is a string "ip:port"
+ */
+int
+socket_server_rawaddr_size(const char *addr) {
+	switch ((uint8_t)addr[0]) {
+	case PROTOCOL_UDP:
+		return 1+2+4;
+	case PROTOCOL_UDPv6:
+		return 1+2+16;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief format the peer address as "ip:port"
+ * @param[in] addr the peer address of SOCKET_ACCEPT, in udp address format or formatted already
+ * @param[in] addrsz bytes of addr
+ * @param[out] buffer where to format
+ * @param[in] sz size of buffer
+ * @return buffer, or NULL if addr is invalid
+ */
+const char *
+socket_server_format_address(const char *addr, int addrsz, char *buffer, int sz) {
+	int family;
+	if (addrsz <= 0) {
+		return NULL;
+	}
+	int rawsz = socket_server_rawaddr_size(addr);
+	if (rawsz > addrsz) {
+		return NULL;
+	}
+	switch ((uint8_t)addr[0]) {
+	case PROTOCOL_UDP:
+		family = AF_INET;
+		break;
+	case PROTOCOL_UDPv6:
+		family = AF_INET6;
+		break;
+	default:
+		snprintf(buffer, sz, "%.*s", addrsz, addr);
+		return buffer;
+	}
+	uint16_t port;
+	memcpy(&port, addr+1, sizeof(port));
+	char tmp[INET6_ADDRSTRLEN];
+	if (inet_ntop(family, addr+3, tmp, sizeof(tmp)) == NULL) {
+		return NULL;
+	}
+	snprintf(buffer, sz, "%s:%d", tmp, ntohs(port));
+	return buffer;
+}
+
 // UDP
 /**
  * @brief send request msg to socket thread to init a udp socket
@@ -2007,7 +2868,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	/*work as a server*/
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 		if (fd < 0) {
 			return -1;
 		}
@@ -2039,7 +2900,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 }
 
 /**
- * @breif send  udp wait to send to socket thread by pipe
+ * @breif send  udp wait to send to socket thread by ctrl ring
  * @param[in] ss socket manager
  * @param[ib] id id of hte socket
  * @param[in] addr address of the udp 
@@ -2049,7 +2910,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
  */
 int64_t 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return -1;
 	}
@@ -2057,6 +2918,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 	struct request_package request;
 	request.u.send_udp.send.id = id;
 	request.u.send_udp.send.sz = sz;
+	request.u.send_udp.send.offset = 0;
 	request.u.send_udp.send.buffer = (char *)buffer;
 
 	const uint8_t *udp_address = (const uint8_t *)addr;
@@ -10,6 +10,7 @@
 #define SOCKET_ERROR 4
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
+#define SOCKET_WARNING 7
 
 struct socket_server;
 
@@ -24,9 +25,14 @@ struct socket_message {
 	char * data;            /*payload*/
 };
 
-struct socket_server * socket_server_create();
+// shard is the index of this server in nshard servers, the ids it allocs are shard + n * nshard
+// max_event is the max events of one wait, 0 for default
+// slot is the initial size of the socket table, it grows up to max_slot (0 for default 65536)
+struct socket_server * socket_server_create(int shard, int nshard, int max_event, int slot, int max_slot);
 void socket_server_release(struct socket_server *);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
+// like socket_server_poll, but return -1 instead of wait
+int socket_server_trypoll(struct socket_server *, struct socket_message *result);
 
 void socket_server_exit(struct socket_server *);
 void socket_server_close(struct socket_server *, uintptr_t opaque, int id);
@@ -38,11 +44,15 @@ void socket_server_send_lowpriority(struct socket_server *, int id, const void *
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// group is the id returned by the first listen of the group (-1 for the first one), accept of the group is reported with it
+int socket_server_listen_reuseport(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog, int group);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// SOCKET_WARNING is reported when the bytes wait to send rise to high (ud is the KB), and when they fall to low (ud is 0)
+void socket_server_watermark(struct socket_server *, int id, int64_t high, int64_t low);
 
 struct socket_udp_address;
 
@@ -65,5 +75,13 @@ struct socket_object_interface {
 
 // if you send package sz == -1, use soi.
 void socket_server_userobject(struct socket_server *, struct socket_object_interface *soi);
+// hand the accepted sockets to all the shards by turns
+void socket_server_peer(struct socket_server *, struct socket_server **peer);
+// accept at most max_accept connections for one readiness of the listen socket,
+// if rawaddr, the peer address of SOCKET_ACCEPT is in udp address format and formatted by socket_server_format_address
+void socket_server_accept(struct socket_server *, int max_accept, int rawaddr);
+// size of the peer address in udp address format, 0 if it's a string "ip:port"
+int socket_server_rawaddr_size(const char *addr);
+const char * socket_server_format_address(const char *addr, int addrsz, char *buffer, int sz);
 
 #endif
@@ -0,0 +1,39 @@
+-- Pairs of services send to each other at the same time, every send grabs the
+-- handle of its target, but no message queue is shared by two senders.
+-- The sink and sender services of testmqcontention are reused, one sink per sender.
+-- Build skynet with and without the rwlock handle lookup to compare :
+--   make linux
+--   make linux MYCFLAGS=-DHANDLE_RWLOCK
+-- Usage (in console) : testhandlegrab [pairs] [messages per sender]
+
+local skynet = require "skynet"
+require "skynet.manager"
+
+local npairs, n = ...
+npairs = tonumber(npairs) or 8
+n = tonumber(n) or 200000
+
+skynet.start(function()
+	local sinks = {}
+	local senders = {}
+	for i = 1, npairs do
+		sinks[i] = skynet.newservice("testmqcontention", "sink", n)
+		senders[i] = skynet.newservice("testmqcontention", "sender", sinks[i], n)
+	end
+	local start = skynet.now()
+	for i = 1, npairs do
+		skynet.fork(skynet.call, senders[i], "lua")
+	end
+	local count = 0
+	for i = 1, npairs do
+		count = count + skynet.call(sinks[i], "lua", "wait")
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("pairs=%d messages=%d time=%.2fs (%.0f msg/s)",
+		npairs, count, ti / 100, ti > 0 and count * 100 / ti or 0))
+	for i = 1, npairs do
+		skynet.kill(senders[i])
+		skynet.kill(sinks[i])
+	end
+	skynet.exit()
+end)
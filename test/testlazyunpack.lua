@@ -0,0 +1,129 @@
+-- A router reads the first value of a message (the destination) and forwards it, the payload is a large table.
+-- The eager router unpacks the whole message and packs it again, the lazy router keeps the original buffer
+-- (skynet.forward_type), reads the destination by skynet.lazyunpack and redirects the buffer untouched.
+-- Before the benchmark, lazy tables untouched and partly decoded are packed again and compared with the eager result.
+-- Usage (in console) : testlazyunpack [messages] [table size]
+
+local skynet = require "skynet"
+require "skynet.manager"	-- inject skynet.forward_type
+
+local mode, arg1, arg2 = ...
+
+if mode == "eager" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(session, source, dest, ...)
+		skynet.redirect(dest, source, "lua", session, skynet.pack(dest, ...))
+	end)
+end)
+
+elseif mode == "lazy" then
+
+skynet.register_protocol {
+	name = "system",
+	id = skynet.PTYPE_SYSTEM,
+	unpack = function (...) return ... end,
+}
+
+local forward_map = {
+	[skynet.PTYPE_LUA] = skynet.PTYPE_SYSTEM,
+}
+
+skynet.forward_type(forward_map, function()
+	skynet.dispatch("system", function(session, source, msg, sz)
+		local dest = skynet.lazyunpack(msg, sz, 1)
+		-- the buffer is not freed in forward mode, redirect it
+		skynet.redirect(dest, source, "lua", session, msg, sz)
+	end)
+end)
+
+elseif mode == "sink" then
+
+skynet.start(function()
+	local count = 0
+	skynet.dispatch("lua", function(session, source, dest, payload)
+		if payload == "sync" then
+			skynet.ret(skynet.pack(count))
+		else
+			count = count + 1
+		end
+	end)
+end)
+
+else
+
+local n = tonumber(mode) or 1000
+local size = tonumber(arg1) or 1000
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+-- pack the lazy table again after touch(t), and unpack it eagerly
+local function repack(msg, sz, touch)
+	local dest, t = skynet.lazyunpack(msg, sz)
+	touch(t)
+	local msg2, sz2 = skynet.pack(dest, t)
+	local _, r = skynet.unpack(msg2, sz2)
+	skynet.trash(msg2, sz2)
+	return r
+end
+
+local function check()
+	local payload = { name = "board", list = {} }
+	for i = 1, 100 do
+		payload.list[i] = { id = i, tags = { "t" .. i, i * 2 }, pos = { x = i, y = -i } }
+	end
+	local msg, sz = skynet.pack("dest", payload)
+	local _, eager = skynet.unpack(msg, sz)
+	assert(equal(eager, payload))
+	assert(equal(repack(msg, sz, function() end), eager), "untouched")
+	assert(equal(repack(msg, sz, function(t) assert(t.name == "board") end), eager), "first level")
+	assert(equal(repack(msg, sz, function(t) assert(t.list[7].tags[2] == 14) end), eager), "nested")
+	assert(equal(repack(msg, sz, function(t) t.list[3].pos.x = 0 end), eager) == false, "changed")
+	skynet.trash(msg, sz)
+end
+
+local function bench(payload, router)
+	local r = skynet.newservice(SERVICE_NAME, router)
+	local sink = skynet.newservice(SERVICE_NAME, "sink")
+	local start = skynet.now()
+	for i = 1, n do
+		skynet.send(r, "lua", sink, payload)
+	end
+	-- the response of sink comes back to us directly
+	local count = skynet.call(r, "lua", sink, "sync")
+	local ti = skynet.now() - start
+	assert(count == n)
+	skynet.kill(r)
+	skynet.kill(sink)
+	return ti
+end
+
+skynet.start(function()
+	check()
+	local payload = {}
+	for i = 1, size do
+		payload[i] = { id = i, name = "item" .. i, count = i % 10 }
+	end
+	local eager = bench(payload, "eager")
+	local lazy = bench(payload, "lazy")
+	skynet.error(string.format("messages=%d size=%d eager=%.2fs (%.0f/s) lazy=%.2fs (%.0f/s)",
+		n, size, eager / 100, eager > 0 and n * 100 / eager or 0, lazy / 100, lazy > 0 and n * 100 / lazy or 0))
+	skynet.exit()
+end)
+
+end
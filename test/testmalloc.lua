@@ -0,0 +1,75 @@
+-- Allocation throughput of skynet_malloc/skynet_free (the lua allocator of snlua), services allocate
+-- small tables and strings in a loop, and send packed messages by turns (freed by the receiver).
+-- Run it with thread = 32 in config, the memory counters are updated by all the worker threads.
+-- Build with jemalloc (make linux), the counters are not compiled with NOUSE_JEMALLOC.
+-- Compare lua_arena = true in config, the small lua objects are alloc from the chunks of each service.
+-- Usage (in console) : testmalloc [services] [rounds] [table size]
+
+local skynet = require "skynet"
+local memory = require "memory"
+require "skynet.manager"
+
+local mode, arg1, arg2 = ...
+
+if mode == "worker" then
+
+local rounds = tonumber(arg1)
+local size = tonumber(arg2)
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, peer)
+		if cmd == "msg" then
+			return
+		end
+		local ops = 0
+		for i = 1, rounds do
+			local t = {}
+			for j = 1, size do
+				t[j] = tostring(i + j)
+			end
+			ops = ops + size + 2
+			if i % 100 == 0 then
+				skynet.send(peer, "lua", "msg", t)
+				skynet.yield()
+			end
+		end
+		skynet.ret(skynet.pack(ops))
+	end)
+end)
+
+else
+
+local services = tonumber(mode) or 32
+local rounds = tonumber(arg1) or 100000
+local size = tonumber(arg2) or 8
+
+skynet.start(function()
+	local list = {}
+	for i = 1, services do
+		list[i] = skynet.newservice(SERVICE_NAME, "worker", rounds, size)
+	end
+	local start = skynet.now()
+	local total = 0
+	local done = 0
+	for i = 1, services do
+		skynet.fork(function()
+			local ops = skynet.call(list[i], "lua", "run", list[i % services + 1])
+			total = total + ops
+			done = done + 1
+		end)
+	end
+	while done < services do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("threads=%s services=%d allocs=%d time=%.2fs (%.0f allocs/s) memory=%dKB block=%d",
+		skynet.getenv "thread", services, total, ti / 100, ti > 0 and total * 100 / ti or 0,
+		memory.total() // 1024, memory.block()))
+	memory.dump()
+	for i = 1, services do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
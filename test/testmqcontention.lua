@@ -0,0 +1,76 @@
+-- Many senders push messages into one service queue at the same time.
+-- Build skynet with and without the lock-free message queue to compare :
+--   make linux
+--   make linux MYCFLAGS=-DMQ_LOCKFREE
+-- Usage (in console) : testmqcontention [senders] [messages per sender]
+
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode, arg1, arg2 = ...
+
+if mode == "sink" then
+
+local expect = tonumber(arg1)
+local count = 0
+local waiting
+
+skynet.start(function()
+	skynet.dispatch("lua", function(session, _, cmd)
+		if cmd == "wait" then
+			if count < expect then
+				waiting = coroutine.running()
+				skynet.wait()
+			end
+			skynet.ret(skynet.pack(count))
+		else
+			count = count + 1
+			if count == expect and waiting then
+				skynet.wakeup(waiting)
+			end
+		end
+	end)
+end)
+
+elseif mode == "sender" then
+
+local sink = tonumber(arg1)
+local n = tonumber(arg2)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		for i = 1, n do
+			skynet.send(sink, "lua", "inc")
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local senders = tonumber(mode) or 16
+local n = tonumber(arg1) or 100000
+
+skynet.start(function()
+	local total = senders * n
+	local sink = skynet.newservice(SERVICE_NAME, "sink", total)
+	local list = {}
+	for i = 1, senders do
+		list[i] = skynet.newservice(SERVICE_NAME, "sender", sink, n)
+	end
+	local start = skynet.now()
+	for i = 1, senders do
+		skynet.fork(skynet.call, list[i], "lua")
+	end
+	local count = skynet.call(sink, "lua", "wait")
+	local ti = skynet.now() - start
+	skynet.error(string.format("senders=%d messages=%d time=%.2fs (%.0f msg/s)",
+		senders, count, ti / 100, ti > 0 and count * 100 / ti or 0))
+	skynet.kill(sink)
+	for i = 1, senders do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,61 @@
+-- Throughput of skynet.pack and skynet.unpack over some representative message shapes :
+-- a small array, a record with string keys, a list of records (nested tables) and a long string.
+-- The packed buffers are freed by skynet.trash, like the messages freed by the receiver.
+-- Usage (in console) : testseri [seconds per shape] [list size]
+
+local skynet = require "skynet"
+require "skynet.manager"
+
+local ti, size = ...
+ti = (tonumber(ti) or 1) * 100
+size = tonumber(size) or 100
+
+local function record(i)
+	return { id = i, name = "player" .. i, level = i % 100, exp = i * 1.5, online = i % 2 == 0 }
+end
+
+local function shapes()
+	local list = {}
+	for i = 1, size do
+		list[i] = record(i)
+	end
+	return {
+		{ "array", { 1, 2, 3, 4, 5, 6, 7, 8 } },
+		{ "record", record(1) },
+		{ "list", list },
+		{ "string", string.rep("x", 16 * 1024) },
+	}
+end
+
+-- run f by batches of 100 for ti, returns the rounds and the seconds
+local function run(f, ...)
+	local n = 0
+	local start = skynet.now()
+	repeat
+		for i = 1, 100 do
+			f(...)
+		end
+		n = n + 100
+	until skynet.now() - start >= ti
+	return n, (skynet.now() - start) / 100
+end
+
+local function pack(obj)
+	skynet.trash(skynet.pack(obj))
+end
+
+local function bench(name, obj)
+	local pn, pt = run(pack, obj)
+	local msg, sz = skynet.pack(obj)
+	local un, ut = run(skynet.unpack, msg, sz)
+	skynet.trash(msg, sz)
+	skynet.error(string.format("%-6s size=%-6d pack=%.0f/s (%.1fMB/s) unpack=%.0f/s (%.1fMB/s)",
+		name, sz, pn / pt, pn * sz / pt / 1048576, un / ut, un * sz / ut / 1048576))
+end
+
+skynet.start(function()
+	for _, s in ipairs(shapes()) do
+		bench(s[1], s[2])
+	end
+	skynet.exit()
+end)
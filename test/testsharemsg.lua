@@ -0,0 +1,108 @@
+-- Broadcast a large read-only table (a leaderboard) to many services, by the "lua" protocol (packed and
+-- unpacked by every receiver) and by the "share" protocol of sharemsg (one object referenced by all the messages).
+-- The receivers read a few fields only. After the receivers collect their boxes, only the reference of
+-- the sender is left. The messages dropped (the receiver is killed before it dispatches them) and the
+-- sends to an invalid address don't keep a reference, and the remote addresses are rejected.
+-- Usage (in console) : testsharemsg [services] [rounds] [table size]
+
+local skynet = require "skynet"
+local sharemsg = require "sharemsg"
+local sd = require "sharedata.corelib"
+require "skynet.manager"
+
+local mode, arg1, arg2 = ...
+
+if mode == "worker" then
+
+local function peek(board)
+	return board[1].score + board[#board].score
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, board)
+		if cmd == "board" then
+			peek(board)
+		elseif cmd == "spin" then
+			-- keep the worker busy, the messages after it stay in the queue
+			local t = os.clock()
+			while os.clock() - t < 0.1 do end
+		else
+			collectgarbage()
+			skynet.ret()
+		end
+	end)
+	skynet.dispatch("share", function(_, _, board)
+		peek(board)
+	end)
+end)
+
+else
+
+local services = tonumber(mode) or 100
+local rounds = tonumber(arg1) or 5
+local size = tonumber(arg2) or 10000
+
+local function sync(list)
+	for i = 1, services do
+		skynet.call(list[i], "lua", "sync")
+	end
+end
+
+local function check_drop(obj)
+	local cobj = obj.__obj
+	local w = skynet.newservice(SERVICE_NAME, "worker")
+	skynet.send(w, "lua", "spin")
+	for i = 1, 100 do
+		sharemsg.send(w, obj)
+	end
+	skynet.kill(w)
+	-- the queue of w is released by a worker thread
+	skynet.sleep(50)
+	assert(sd.host.getref(cobj) == 1, "the dropped messages keep the object")
+	assert(not sharemsg.send(w, obj), "send to a dead service")
+	assert(sd.host.getref(cobj) == 1, "the failed send keeps the object")
+	local remote = (skynet.harbor(skynet.self()) % 255 + 1) << 24 | 1
+	assert(not pcall(sharemsg.send, remote, obj), "send to a remote harbor")
+end
+
+skynet.start(function()
+	local list = {}
+	for i = 1, services do
+		list[i] = skynet.newservice(SERVICE_NAME, "worker")
+	end
+	local board = {}
+	for i = 1, size do
+		board[i] = { id = i, name = "player" .. i, score = size - i }
+	end
+
+	local start = skynet.now()
+	for r = 1, rounds do
+		for i = 1, services do
+			skynet.send(list[i], "lua", "board", board)
+		end
+	end
+	sync(list)
+	local lua = skynet.now() - start
+
+	start = skynet.now()
+	local obj = sharemsg.new(board)
+	for r = 1, rounds do
+		for i = 1, services do
+			sharemsg.send(list[i], obj)
+		end
+	end
+	sync(list)
+	local share = skynet.now() - start
+	local ref = sd.host.getref(obj.__obj)
+
+	skynet.error(string.format("services=%d rounds=%d size=%d lua=%.2fs share=%.2fs (new included) ref=%d",
+		services, rounds, size, lua / 100, share / 100, ref))
+	assert(ref == 1)
+	check_drop(obj)
+	for i = 1, services do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
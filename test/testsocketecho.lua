@@ -0,0 +1,101 @@
+-- Echo load with many connections, every client writes a packet on all its connections
+-- and reads the echo back, round by round.
+-- Compare socket_batch = 1 (default) and socket_batch = 256 in config, 10k connections need
+-- about 20k fds (ulimit -n).
+-- Build skynet with epoll (default) and io_uring to compare the poller backends :
+--   make linux
+--   make linux MYCFLAGS=-DSOCKET_IOURING
+-- Usage (in console) : testsocketecho [connections] [rounds] [packet size] [clients]
+
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"
+
+local mode, arg1, arg2, arg3 = ...
+
+local PORT = 8003
+
+if mode == "client" then
+
+local conns = tonumber(arg1)
+local rounds = tonumber(arg2)
+local size = tonumber(arg3)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local list = {}
+		for i = 1, conns do
+			list[i] = assert(socket.open("127.0.0.1", PORT))
+		end
+		local packet = string.rep("x", size)
+		local echo = 0
+		for r = 1, rounds do
+			for i = 1, conns do
+				socket.write(list[i], packet)
+			end
+			for i = 1, conns do
+				if socket.read(list[i], size) then
+					echo = echo + 1
+				end
+			end
+		end
+		for i = 1, conns do
+			socket.close(list[i])
+		end
+		skynet.ret(skynet.pack(echo))
+	end)
+end)
+
+else
+
+local conns = tonumber(mode) or 10000
+local rounds = tonumber(arg1) or 20
+local size = tonumber(arg2) or 64
+local clients = tonumber(arg3) or 8
+
+local function echo(id)
+	socket.start(id)
+	while true do
+		local str = socket.read(id)
+		if not str then
+			break
+		end
+		socket.write(id, str)
+	end
+	socket.close(id)
+end
+
+skynet.start(function()
+	local listen = socket.listen("127.0.0.1", PORT, 4096)
+	socket.start(listen, function(id)
+		skynet.fork(echo, id)
+	end)
+	local list = {}
+	for i = 1, clients do
+		local n = conns // clients + (i <= conns % clients and 1 or 0)
+		list[i] = skynet.newservice(SERVICE_NAME, "client", n, rounds, size)
+	end
+	local start = skynet.now()
+	local total = 0
+	local done = 0
+	for i = 1, clients do
+		skynet.fork(function()
+			local n = skynet.call(list[i], "lua")
+			total = total + n
+			done = done + 1
+		end)
+	end
+	while done < clients do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("batch=%s connections=%d rounds=%d size=%d echo=%d time=%.2fs (%.0f echo/s)",
+		skynet.getenv "socket_batch" or "1", conns, rounds, size, total, ti / 100, ti > 0 and total * 100 / ti or 0))
+	socket.close(listen)
+	for i = 1, clients do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
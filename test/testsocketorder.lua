@@ -0,0 +1,103 @@
+-- Writers in different services write framed packets to one socket at the same time, the reader checks
+-- every frame is complete and the packets of each writer are in order. The packets are large and the
+-- reader is slow at first, so the workers write a part directly and the rest goes to the socket thread.
+-- The second round writes tiny packets directly until the kernel buffer is full, the direct write writes
+-- a part or nothing, and the socket must not stop writing after that.
+-- Usage (in console) : testsocketorder [writers] [packets] [max packet size] [tiny packets]
+
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"
+
+local mode, arg1, arg2, arg3 = ...
+
+local PORT = 8006
+
+if mode == "writer" then
+
+local index = tonumber(arg1)
+local packets = tonumber(arg2)
+local size = tonumber(arg3)
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, id)
+		for i = 1, packets do
+			local body = string.pack(">I4I4", index, i) .. string.rep(string.char(65 + index % 26), i * 7919 % size)
+			socket.write(id, string.pack(">s4", body))
+			if i % 16 == 0 then
+				skynet.yield()
+			end
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local writers = tonumber(mode) or 8
+local packets = tonumber(arg1) or 200
+local size = tonumber(arg2) or 65536
+local tiny = tonumber(arg3) or 100000
+
+local function recv(id, packets, size, delay, done)
+	-- let the kernel buffer fill up, the socket is not read before start
+	skynet.sleep(delay)
+	socket.start(id)
+	local last = {}
+	for i = 1, writers do
+		last[i] = 0
+	end
+	for n = 1, writers * packets do
+		local len = string.unpack(">I4", assert(socket.read(id, 4)))
+		local body = assert(socket.read(id, len))
+		local index, seq = string.unpack(">I4I4", body)
+		assert(index >= 1 and index <= writers, "broken frame")
+		assert(seq == last[index] + 1, "packet out of order")
+		assert(body:sub(9) == string.rep(string.char(65 + index % 26), seq * 7919 % size), "broken packet")
+		last[index] = seq
+	end
+	socket.close(id)
+	done()
+end
+
+local function test(port, packets, size, delay)
+	local finished = false
+	local listen = socket.listen("127.0.0.1", port)
+	socket.start(listen, function(id)
+		skynet.fork(recv, id, packets, size, delay, function() finished = true end)
+	end)
+	local id = assert(socket.open("127.0.0.1", port))
+	local list = {}
+	for i = 1, writers do
+		list[i] = skynet.newservice(SERVICE_NAME, "writer", i, packets, size)
+	end
+	local start = skynet.now()
+	local done = 0
+	for i = 1, writers do
+		skynet.fork(function()
+			skynet.call(list[i], "lua", id)
+			done = done + 1
+		end)
+	end
+	while done < writers or not finished do
+		-- a socket never written again after a direct write stops the reader
+		assert(skynet.now() - start < delay + 3000, "stalled")
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("writers=%d packets=%d max size=%d time=%.2fs, all in order",
+		writers, writers * packets, size, ti / 100))
+	socket.close(id)
+	socket.close(listen)
+	for i = 1, writers do
+		skynet.kill(list[i])
+	end
+end
+
+skynet.start(function()
+	test(PORT, packets, size, 10)
+	test(PORT + 1, tiny, 16, 100)
+	skynet.exit()
+end)
+
+end
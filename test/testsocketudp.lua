@@ -0,0 +1,91 @@
+-- Loopback udp packets per second, senders write bursts of datagrams to one udp socket.
+-- Datagrams are received by recvmmsg and sent by sendmmsg on linux, compare socket_batch = 1 (default)
+-- and socket_batch = 256 in config. Senders wait after each burst when too many datagrams are
+-- in flight, so the receive buffer of the kernel is not overrun, the datagrams dropped are reported as lost.
+-- Usage (in console) : testsocketudp [senders] [packets per burst] [bursts] [packet size]
+
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"
+
+local mode, arg1, arg2, arg3, arg4 = ...
+
+local PORT = 8004
+
+if mode == "sender" then
+
+local receiver = tonumber(arg1)
+local burst = tonumber(arg2)
+local rounds = tonumber(arg3)
+local size = tonumber(arg4)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local id = socket.udp(function() end)
+		socket.udp_connect(id, "127.0.0.1", PORT)
+		local packet = string.rep("x", size)
+		for i = 1, rounds do
+			for j = 1, burst do
+				socket.write(id, packet)
+			end
+			skynet.call(receiver, "lua", "sent", burst)
+		end
+		socket.close(id)
+		skynet.ret()
+	end)
+end)
+
+else
+
+local senders = tonumber(mode) or 4
+local burst = tonumber(arg1) or 32
+local rounds = tonumber(arg2) or 2000
+local size = tonumber(arg3) or 64
+local window = 128
+
+skynet.start(function()
+	local count = 0
+	local sent = 0
+	local last = 0
+	local recv = socket.udp(function(str, from)
+		count = count + 1
+		last = skynet.now()
+	end, "127.0.0.1", PORT)
+	skynet.dispatch("lua", function(_, _, cmd, n)
+		sent = sent + n
+		local ti = skynet.now()
+		-- give up the lost datagrams after 0.1s
+		while sent - count > window and skynet.now() - ti < 10 do
+			skynet.yield()
+		end
+		skynet.ret()
+	end)
+	local list = {}
+	for i = 1, senders do
+		list[i] = skynet.newservice(SERVICE_NAME, "sender", skynet.self(), burst, rounds, size)
+	end
+	local expect = senders * burst * rounds
+	local start = skynet.now()
+	local done = 0
+	for i = 1, senders do
+		skynet.fork(function()
+			skynet.call(list[i], "lua")
+			done = done + 1
+		end)
+	end
+	-- wait for the senders, and the datagrams in flight
+	while done < senders or (count < expect and skynet.now() - last < 50) do
+		skynet.sleep(1)
+	end
+	local ti = last - start
+	skynet.error(string.format("batch=%s senders=%d packets=%d size=%d received=%d lost=%d time=%.2fs (%.0f packets/s)",
+		skynet.getenv "socket_batch" or "1", senders, expect, size, count, expect - count,
+		ti / 100, ti > 0 and count * 100 / ti or 0))
+	socket.close(recv)
+	for i = 1, senders do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
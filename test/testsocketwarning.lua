@@ -0,0 +1,86 @@
+-- The server writes 64KB chunks to a client, socket.drain blocks the producer when the bytes wait to send
+-- reach the high watermark, until they fall to the low watermark. Every warning is followed by a drained one.
+-- Usage (in console) : testsocketwarning [MB to send] [high watermark KB] [low watermark KB]
+
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"
+
+local mode, arg1, arg2 = ...
+
+local PORT = 8005
+
+if mode == "client" then
+
+skynet.start(function()
+	local id = assert(socket.open("127.0.0.1", PORT))
+	skynet.dispatch("lua", function(_, _, cmd, size)
+		local n = 0
+		while n < size do
+			local str = socket.read(id)
+			if not str then
+				break
+			end
+			n = n + #str
+		end
+		socket.close(id)
+		skynet.ret(skynet.pack(n))
+	end)
+end)
+
+else
+
+local mb = tonumber(mode) or 64
+local high = (tonumber(arg1) or 1024) * 1024
+local low = (tonumber(arg2) or 256) * 1024
+
+skynet.start(function()
+	local chunk = string.rep("x", 64 * 1024)
+	local total = mb * 1024 * 1024
+	local warning, drained, peak = 0, 0, 0
+	local blocked = 0
+	local done = false
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(id)
+		socket.start(id)
+		socket.watermark(id, high, low)
+		socket.warning(id, function(_, size)
+			if size > 0 then
+				warning = warning + 1
+				peak = math.max(peak, size)
+			else
+				drained = drained + 1
+			end
+		end)
+		skynet.fork(function()
+			local sent = 0
+			while sent < total do
+				socket.write(id, chunk)
+				sent = sent + #chunk
+				-- the warning is a message, let it in like a producer driven by messages
+				skynet.yield()
+				local ti = skynet.now()
+				if not socket.drain(id) then
+					break
+				end
+				blocked = blocked + skynet.now() - ti
+			end
+			done = true
+		end)
+	end)
+	local start = skynet.now()
+	local client = skynet.newservice(SERVICE_NAME, "client")
+	local n = skynet.call(client, "lua", "read", total)
+	while not done do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	skynet.error(string.format("sent=%dMB received=%dMB warning=%d drained=%d peak=%dKB blocked=%.2fs time=%.2fs",
+		mb, n // (1024 * 1024), warning, drained, peak, blocked / 100, ti / 100))
+	assert(n == total and warning > 0 and warning == drained)
+	socket.close(listen)
+	skynet.kill(client)
+	skynet.exit()
+end)
+
+end
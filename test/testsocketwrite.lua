@@ -0,0 +1,88 @@
+-- Clients write many small packets in one dispatch, the server counts the bytes.
+-- Usage (in console) : testsocketwrite [clients] [packets per batch] [batches] [packet size]
+
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"
+
+local mode, arg1, arg2, arg3, arg4 = ...
+
+local PORT = 8002
+
+if mode == "client" then
+
+local batch = tonumber(arg1)
+local rounds = tonumber(arg2)
+local size = tonumber(arg3)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local id = assert(socket.open("127.0.0.1", PORT))
+		local packet = string.rep("x", size)
+		for i = 1, rounds do
+			for j = 1, batch do
+				socket.write(id, packet)
+			end
+			-- let the socket thread flush the batch
+			skynet.yield()
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local clients = tonumber(mode) or 8
+local batch = tonumber(arg1) or 50
+local rounds = tonumber(arg2) or 2000
+local size = tonumber(arg3) or 32
+
+local function recv(id, expect, done)
+	socket.start(id)
+	local n = 0
+	while n < expect do
+		local str = socket.read(id)
+		if not str then
+			break
+		end
+		n = n + #str
+	end
+	socket.close(id)
+	done(n)
+end
+
+skynet.start(function()
+	local expect = batch * rounds * size
+	local total = 0
+	local finished = 0
+	local function done(n)
+		total = total + n
+		finished = finished + 1
+	end
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(id)
+		skynet.fork(recv, id, expect, done)
+	end)
+	local list = {}
+	for i = 1, clients do
+		list[i] = skynet.newservice(SERVICE_NAME, "client", batch, rounds, size)
+	end
+	local start = skynet.now()
+	for i = 1, clients do
+		skynet.fork(skynet.call, list[i], "lua")
+	end
+	while finished < clients do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	local packets = clients * batch * rounds
+	skynet.error(string.format("clients=%d packets=%d size=%d bytes=%d time=%.2fs (%.0f packets/s)",
+		clients, packets, size, total, ti / 100, ti > 0 and packets * 100 / ti or 0))
+	socket.close(listen)
+	for i = 1, clients do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,76 @@
+-- Several services add timers and cancel most of them at the same time.
+-- Cancelled timers must not fire, the others must fire exactly once.
+-- Usage (in console) : testtimercancel [services] [timers per service]
+
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode, arg1 = ...
+
+if mode == "worker" then
+
+local n = tonumber(arg1)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local fired = 0
+		local cancelled = 0
+		local sessions = {}
+		local start = skynet.now()
+		for i = 1, n do
+			-- every 4th timer is kept
+			local keep = i % 4 == 0
+			sessions[i] = skynet.timeout(keep and 1 or 1000, function()
+				assert(keep, "cancelled timer fired")
+				fired = fired + 1
+			end)
+		end
+		for i = 1, n do
+			if i % 4 ~= 0 and skynet.canceltimeout(sessions[i]) then
+				cancelled = cancelled + 1
+			end
+		end
+		local ti = skynet.now() - start
+		while fired < n // 4 do
+			skynet.sleep(1)
+		end
+		skynet.ret(skynet.pack(fired, cancelled, ti))
+	end)
+end)
+
+else
+
+local services = tonumber(mode) or 8
+local n = tonumber(arg1) or 100000
+
+skynet.start(function()
+	local list = {}
+	for i = 1, services do
+		list[i] = skynet.newservice(SERVICE_NAME, "worker", n)
+	end
+	local start = skynet.now()
+	local fired, cancelled, addcancel = 0, 0, 0
+	local done = 0
+	for i = 1, services do
+		skynet.fork(function()
+			local f, c, ti = skynet.call(list[i], "lua")
+			fired = fired + f
+			cancelled = cancelled + c
+			addcancel = math.max(addcancel, ti)
+			done = done + 1
+		end)
+	end
+	while done < services do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	assert(cancelled == services * (n - n // 4))
+	skynet.error(string.format("services=%d timers=%d fired=%d cancelled=%d add/cancel=%.2fs total=%.2fs",
+		services, services * n, fired, cancelled, addcancel / 100, ti / 100))
+	for i = 1, services do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end
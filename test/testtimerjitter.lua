@@ -0,0 +1,67 @@
+-- Measure the latency jitter of skynet.sleep_ms.
+-- Compare timer_resolution = 100 (default) and timer_resolution = 1000 in config.
+-- Usage (in console) : testtimerjitter [services] [interval ms] [rounds]
+
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode, arg1, arg2 = ...
+
+if mode == "ticker" then
+
+local interval = tonumber(arg1)
+local rounds = tonumber(arg2)
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local delay = {}
+		for i = 1, rounds do
+			local start = skynet.now_ms()
+			skynet.sleep_ms(interval)
+			delay[i] = skynet.now_ms() - start - interval
+		end
+		skynet.ret(skynet.pack(delay))
+	end)
+end)
+
+else
+
+local services = tonumber(mode) or 4
+local interval = tonumber(arg1) or 1
+local rounds = tonumber(arg2) or 1000
+
+skynet.start(function()
+	local list = {}
+	for i = 1, services do
+		list[i] = skynet.newservice(SERVICE_NAME, "ticker", interval, rounds)
+	end
+	local all = {}
+	local done = 0
+	for i = 1, services do
+		skynet.fork(function()
+			local delay = skynet.call(list[i], "lua")
+			table.move(delay, 1, #delay, #all + 1, all)
+			done = done + 1
+		end)
+	end
+	while done < services do
+		skynet.sleep(10)
+	end
+	table.sort(all)
+	local sum = 0
+	for _, v in ipairs(all) do
+		sum = sum + v
+	end
+	local function percentile(p)
+		return all[math.max(1, math.ceil(#all * p))]
+	end
+	skynet.error(string.format("resolution=%s interval=%dms samples=%d late: avg=%.2fms p50=%dms p99=%dms max=%dms",
+		skynet.getenv "timer_resolution" or "100", interval, #all, sum / #all,
+		percentile(0.5), percentile(0.99), all[#all]))
+	for i = 1, services do
+		skynet.kill(list[i])
+	end
+	skynet.exit()
+end)
+
+end